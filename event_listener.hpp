@@ -0,0 +1,3895 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <array>
+#include <bit>
+#include <climits>
+#include <coroutine>
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+
+class EventWorker;
+
+// Return type of a connection coroutine registered with onConnection().
+// The coroutine starts on a pool thread as soon as the connection is
+// accepted and its frame is freed when it returns. It may only co_await
+// the EventWorker::asyncRead/asyncReadFrames/asyncWrite/asyncWriteFrame
+// awaitables.
+struct ConnectionTask
+{
+    struct promise_type
+    {
+        ConnectionTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}   // ends the session like a return
+    };
+};
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool( unsigned numThreads );
+    ~ThreadPool();
+
+    unsigned size() const;
+    int pendingJobs() const;
+
+    void enqueue( std::function<void ()> job );
+
+    ThreadPool( const ThreadPool& )            = delete;
+    ThreadPool& operator=( const ThreadPool& ) = delete;
+
+private:
+    struct JobQueue
+    {
+        std::deque< std::function<void ()> > jobs;
+        std::mutex mutex;
+    };
+
+    void run( unsigned index );
+    bool pop( unsigned index, std::function<void ()>& job );
+    bool steal( unsigned index, std::function<void ()>& job );
+
+    std::vector< std::unique_ptr<JobQueue> > m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::atomic<unsigned> m_nextQueue { 0 };
+    std::atomic<int> m_pendingJobs { 0 };
+    std::atomic<bool> m_stopping { false };
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+};
+
+// Fixed-size block recycler behind PoolAllocator. Blocks are never handed
+// back to the heap while the pool lives, so a steady connection count
+// allocates nothing after warm-up. Blocks may be released on any thread.
+class BlockPool
+{
+public:
+    BlockPool() = default;
+    ~BlockPool();
+
+    void* allocate( std::size_t size );
+    void deallocate( void* block, std::size_t size );
+
+    BlockPool( const BlockPool& )            = delete;
+    BlockPool& operator=( const BlockPool& ) = delete;
+
+private:
+    struct FreeBlock { FreeBlock* next; };
+
+    std::size_t m_blockSize = 0;
+    FreeBlock* m_freeBlocks = nullptr;
+    std::mutex m_mutex;
+};
+
+// std::allocate_shared allocator drawing from a BlockPool. The allocator
+// keeps the pool alive until the last block (and control block) is gone.
+template <class T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    explicit PoolAllocator( std::shared_ptr<BlockPool> pool ) : m_pool( std::move( pool ) ) {}
+    template <class U> PoolAllocator( const PoolAllocator<U>& other ) : m_pool( other.m_pool ) {}
+
+    T* allocate( std::size_t n ) { return static_cast<T*>( m_pool->allocate( n * sizeof( T ) ) ); }
+    void deallocate( T* p, std::size_t n ) { m_pool->deallocate( p, n * sizeof( T ) ); }
+
+    template <class U> bool operator == ( const PoolAllocator<U>& other ) const { return m_pool == other.m_pool; }
+    template <class U> bool operator != ( const PoolAllocator<U>& other ) const { return m_pool != other.m_pool; }
+
+private:
+    template <class U> friend class PoolAllocator;
+
+    std::shared_ptr<BlockPool> m_pool;
+};
+
+// Power-of-two buffer recycler shared by the ReadBuffers of one EventLoop
+class BufferPool
+{
+public:
+    static constexpr std::size_t minBufferSize = 4096;
+
+    char* acquire( std::size_t& size );
+    void release( char* data, std::size_t size );
+
+private:
+    static constexpr std::size_t numSizeClasses = 12; // 4 KiB .. 8 MiB
+
+    static std::size_t sizeClass( std::size_t size );
+
+    std::array<BlockPool, numSizeClasses> m_pools;
+};
+
+// Per-connection receive buffer. Bytes stay where recv put them and are
+// handed out as string_views; the storage comes from a BufferPool, grows
+// on demand and goes back to the pool whenever the buffer drains, so idle
+// connections hold no memory.
+class ReadBuffer
+{
+public:
+    explicit ReadBuffer( std::shared_ptr<BufferPool> pool );
+    ~ReadBuffer();
+
+    bool fill( int fileDescriptor );    // false once the peer has closed
+    void consume( std::size_t numBytes );
+    void release();                     // give the storage back if empty
+    void append( const char* data, std::size_t numBytes );
+    void take( ReadBuffer& other );     // moves the other buffer's bytes behind ours
+
+    std::size_t size() const;
+    std::string_view view() const;
+    uint64_t syscalls() const;
+
+    ReadBuffer( const ReadBuffer& )            = delete;
+    ReadBuffer& operator=( const ReadBuffer& ) = delete;
+
+private:
+    void reserve( std::size_t numBytes );
+
+    std::shared_ptr<BufferPool> m_pool;
+
+    char* m_data           = nullptr;
+    std::size_t m_capacity = 0;
+    std::size_t m_head     = 0;
+    std::size_t m_tail     = 0;
+    uint64_t m_syscalls    = 0;
+};
+
+// Per-connection output queue. Small writes are coalesced into shared
+// chunks, and everything queued goes out in one sendmsg per flush.
+// Not thread-safe on its own; EventWorker serialises access.
+class WriteQueue
+{
+public:
+    enum class FlushResult { Drained, Pending, Failed };
+
+    static constexpr std::size_t chunkSize = 16384;
+
+    explicit WriteQueue( std::shared_ptr<BufferPool> pool );
+    ~WriteQueue();
+
+    void append( std::string_view data );
+    FlushResult flush( int fileDescriptor );
+
+    // For senders other than flush(): the queued bytes as iovecs, and
+    // dropping what has been sent from the front
+    std::size_t gather( iovec* chunks, std::size_t maxChunks ) const;
+    void consume( std::size_t numBytes );
+
+    std::size_t size() const;
+    uint64_t syscalls() const;
+
+    WriteQueue( const WriteQueue& )            = delete;
+    WriteQueue& operator=( const WriteQueue& ) = delete;
+
+private:
+    struct Chunk
+    {
+        char* data           = nullptr;
+        std::size_t capacity = 0;
+        std::size_t head     = 0;
+        std::size_t tail     = 0;
+    };
+
+    std::shared_ptr<BufferPool> m_pool;
+
+    std::vector<Chunk> m_chunks;    // keeps its capacity, no steady-state allocation
+    std::size_t m_firstChunk = 0;
+    std::size_t m_size       = 0;
+    uint64_t m_syscalls      = 0;
+};
+
+// Minimal io_uring on the raw system calls: a submission and completion
+// queue plus one ring of provided buffers that multishot receives pick
+// from. Created disabled, so that enable() makes the calling loop thread
+// the only submitter, and touched by that thread only.
+class IoRing
+{
+public:
+    IoRing( unsigned entries, unsigned numBuffers, unsigned bufferSize );
+    ~IoRing();
+
+    void enable();
+
+    // Next free submission entry, zeroed. Submits what is queued when the
+    // ring is full.
+    io_uring_sqe* prepare();
+
+    // Submits everything prepared and waits for at least one completion,
+    // or until the timeout in milliseconds has passed (-1 waits forever)
+    int submitAndWait( int timeout = -1 );
+
+    template <class F> void forEachCompletion( F&& f );
+
+    char* buffer( unsigned bufferId );
+    void recycle( unsigned bufferId );
+
+    static constexpr unsigned bufferGroup = 0;
+
+    IoRing( const IoRing& )            = delete;
+    IoRing& operator=( const IoRing& ) = delete;
+
+private:
+    int enter( unsigned numSubmissions,
+               unsigned minCompletions,
+               unsigned flags,
+               const void* argument     = nullptr,
+               std::size_t argumentSize = 0 );
+    void release();
+
+    int m_fileDescriptor = -1;
+
+    void* m_rings           = nullptr;
+    std::size_t m_ringsSize = 0;
+    io_uring_sqe* m_sqes    = nullptr;
+    std::size_t m_sqesSize  = 0;
+
+    unsigned* m_sqHead  = nullptr;
+    unsigned* m_sqTail  = nullptr;
+    unsigned* m_sqArray = nullptr;
+    unsigned m_sqMask   = 0;
+    unsigned m_sqTailLocal = 0;
+    unsigned m_unsubmitted = 0;
+
+    unsigned* m_cqHead   = nullptr;
+    unsigned* m_cqTail   = nullptr;
+    unsigned m_cqMask    = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    io_uring_buf_ring* m_bufferRing = nullptr;
+    std::size_t m_bufferRingSize    = 0;
+    char* m_buffers                 = nullptr;
+    unsigned m_numBuffers           = 0;
+    unsigned m_bufferSize           = 0;
+    uint16_t m_bufferTail           = 0;
+};
+
+// Log-linear latency histogram in the spirit of HdrHistogram: 16 linear
+// sub-buckets per power of two (about 6% resolution) over the whole
+// 64-bit range. Recording is a couple of relaxed atomic adds, so it is
+// safe and cheap from any thread.
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned subBucketBits = 4;
+    static constexpr unsigned numSubBuckets = 1u << subBucketBits;
+    static constexpr unsigned numBuckets    = ( 64 - subBucketBits + 1 ) * numSubBuckets;
+
+    void record( uint64_t value );
+    void merge( const LatencyHistogram& other );
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile( double fraction ) const;   // fraction in [0, 1]
+
+private:
+    static unsigned bucketOf( uint64_t value );
+    static uint64_t valueOf( unsigned bucket );
+
+    std::array<std::atomic<uint64_t>, numBuckets> m_buckets {};
+    std::atomic<uint64_t> m_count { 0 };
+    std::atomic<uint64_t> m_sum { 0 };
+    std::atomic<uint64_t> m_max { 0 };
+};
+
+// Always-on counters of one EventLoop; EventListener::dumpStats() sums
+// them over all loops. Latencies are recorded in nanoseconds.
+struct EventMetrics
+{
+    std::atomic<uint64_t> accepts { 0 };
+    std::atomic<uint64_t> closes { 0 };
+    std::atomic<uint64_t> dispatches { 0 };
+    std::atomic<uint64_t> bytesIn { 0 };
+    std::atomic<uint64_t> bytesOut { 0 };
+    std::atomic<uint64_t> framesIn { 0 };
+    std::atomic<uint64_t> recvCalls { 0 };
+    std::atomic<uint64_t> sendCalls { 0 };
+    std::atomic<uint64_t> epollWaits { 0 };
+    std::atomic<uint64_t> timersFired { 0 };
+    std::atomic<uint64_t> timeouts { 0 };    // idle or read deadline closes
+    std::atomic<int64_t> queuedOutput { 0 };
+
+    LatencyHistogram dispatchDelay;     // event seen -> handler starts
+    LatencyHistogram handlerTime;       // time spent inside the handlers
+};
+
+// Hierarchical timing wheel after Varghese and Lauck: four levels of 64
+// slots at millisecond resolution, about 4.6 hours before a deadline has
+// to wait in the last level. A timer sits in the level of the highest bit
+// in which its deadline differs from the current tick and cascades down
+// as the wheel turns, so scheduling, cancelling and firing are O(1), and
+// one occupancy bitmap per level finds the next deadline without walking
+// the slots. Nodes come from a BlockPool. Not thread-safe, each EventLoop
+// owns one and uses it from its own thread.
+class TimerWheel
+{
+public:
+    struct Timer
+    {
+        Timer* prev       = nullptr;
+        Timer* next       = nullptr;
+        uint64_t deadline = 0;      // in ticks
+        unsigned slot     = 0;
+        std::function<void ( Timer* timer )> callback;
+    };
+
+    static constexpr unsigned slotBits  = 6;
+    static constexpr unsigned numSlots  = 1u << slotBits;
+    static constexpr unsigned numLevels = 4;
+
+    TimerWheel() = default;
+    ~TimerWheel();
+
+    // Milliseconds since construction; safe from any thread
+    uint64_t now() const;
+    uint64_t deadline( std::chrono::milliseconds delay ) const;
+
+    // The callback gets its own node, which is freed once it returns
+    Timer* schedule( uint64_t deadline, std::function<void ( Timer* timer )> callback );
+    void cancel( Timer* timer );
+
+    // Fires everything due up to the tick 'now'. Callbacks may schedule
+    // and cancel other timers.
+    void advance( uint64_t now );
+
+    // Milliseconds until advance() has work to do, -1 without timers
+    int timeout( uint64_t now ) const;
+    std::size_t size() const;
+
+    TimerWheel( const TimerWheel& )            = delete;
+    TimerWheel& operator=( const TimerWheel& ) = delete;
+
+private:
+    static constexpr unsigned expiringSlot = numLevels * numSlots;   // fired by advance() right now
+
+    void link( Timer* timer );
+    void unlink( Timer* timer );
+    bool nextTick( uint64_t& tick ) const;
+
+    const std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+
+    uint64_t m_current  = 0;    // the next tick to process
+    std::size_t m_size  = 0;
+    Timer* m_firing     = nullptr;
+
+    std::array<Timer*, expiringSlot + 1> m_slots {};
+    std::array<uint64_t, numLevels> m_occupied {};
+
+    BlockPool m_pool;
+};
+
+class EventLoop;
+
+class EventListener
+{
+public:
+    // How the byte stream of a connection is cut into messages. Raw hands
+    // out whatever has arrived, LengthPrefixed frames start with a 4-byte
+    // big-endian payload length and Newline frames end with '\n' (a '\r'
+    // right before it is dropped).
+    enum class Framing { Raw, LengthPrefixed, Newline };
+
+    // IoUring falls back to Epoll when the kernel refuses the ring
+    enum class Backend { Epoll, IoUring };
+
+    EventListener();
+    ~EventListener();
+
+    void setBacklog( int backlog );
+    void setPort( int port );
+    void setThreadCount( unsigned threadCount );
+    void setReactorCount( unsigned reactorCount );
+    void setCpuAffinity( bool pinReactors );
+    void setOutputLimits( std::size_t highWatermark, std::size_t maxQueued );
+    void setFraming( Framing framing, std::size_t maxFrameSize = 1 << 20 );
+    void setBackend( Backend backend );
+
+    // Drops connections that have neither received nor sent anything for
+    // that long, while no handler runs and no EventWorker::after() timer
+    // is pending. Zero, the default, keeps them forever.
+    void setIdleTimeout( std::chrono::milliseconds timeout );
+
+    // How long close() gives the open connections to finish before they
+    // are dropped
+    void setDrainTimeout( std::chrono::milliseconds timeout );
+
+    // Stops accepting and lets every connection finish what it has
+    // received: handlers and timers run to completion, output drains,
+    // then the connection closes. listen() returns, with the pool joined
+    // and all pooled memory released, once the last one is gone or the
+    // drain timeout has passed. Only an atomic store and an eventfd
+    // write, so it may be called from a signal handler or any thread,
+    // also before listen().
+    void close();
+    void listen();
+
+    // Prints counters and latency percentiles. requestStatsDump() only
+    // flags the request and wakes the first loop, which does the printing,
+    // so it may be called from a signal handler (e.g. on SIGUSR1).
+    void dumpStats( std::ostream& os ) const;
+    void requestStatsDump();
+
+    template <class F> void onAccept( F&& f ) { m_handleAccept = f; }
+    template <class F> void onRead( F&& f ) { m_handleRead = f; }
+
+    // With framing enabled: every complete frame that has arrived, in
+    // order, as one batch. The views stay valid until the handler returns.
+    template <class F> void onFrames( F&& f ) { m_handleFrames = f; }
+
+    // Alternative to onRead: one coroutine per connection, suspended on the
+    // reactor between reads instead of holding a pool thread.
+    template <class F> void onConnection( F&& f ) { m_handleConnection = f; }
+
+private:
+    friend class EventLoop;
+    friend class EventWorker;
+
+    int m_backlog =  1;
+    int m_port    = -1;
+
+    unsigned m_threadCount  = std::max( 1u, std::thread::hardware_concurrency() );
+    unsigned m_reactorCount = 1;
+    bool m_pinReactors      = false;
+
+    std::size_t m_outputHighWatermark = 1 << 20;    // stop reading above this
+    std::size_t m_outputMaxQueued     = 16 << 20;   // drop the connection above this
+
+    Backend m_backend          = Backend::Epoll;
+    Framing m_framing          = Framing::Raw;
+    std::size_t m_maxFrameSize = 1 << 20;           // drop the connection above this
+
+    std::chrono::milliseconds m_idleTimeout { 0 };
+    std::chrono::milliseconds m_drainTimeout { 5000 };
+
+    std::unique_ptr<ThreadPool> m_threadPool;
+    std::vector< std::unique_ptr<EventLoop> > m_eventLoops;
+
+    // Stop and stats requests, watched by the first loop
+    int m_controlFileDescriptor = -1;
+    std::atomic<bool> m_stopRequested { false };
+    std::atomic<bool> m_statsRequested { false };
+    std::atomic<unsigned> m_holds { 0 };            // EventWorker::hold() not released yet
+
+    std::function< void ( std::weak_ptr<EventWorker> worker ) > m_handleAccept;
+    std::function< void ( std::weak_ptr<EventWorker> worker ) > m_handleRead;
+    std::function< void ( std::weak_ptr<EventWorker> worker,
+                          const std::vector<std::string_view>& frames ) > m_handleFrames;
+    std::function< ConnectionTask ( std::shared_ptr<EventWorker> worker ) > m_handleConnection;
+};
+
+// One reactor: a listening socket, an epoll instance or an io_uring, and
+// the connections accepted on that socket. With several reactors every loop
+// binds the same port through SO_REUSEPORT and the kernel spreads new
+// connections.
+class EventLoop
+{
+public:
+    EventLoop( EventListener& eventListener, unsigned index );
+    ~EventLoop();
+
+    void open( bool reusePort );
+    void run();
+
+    void stop();
+    void close( int fileDescriptor );
+
+    std::shared_ptr<BufferPool> bufferPool() const;
+
+    EventLoop( const EventLoop& )            = delete;
+    EventLoop& operator=( const EventLoop& ) = delete;
+
+private:
+    friend class EventListener;
+    friend class EventWorker;
+
+    // Connections are indexed by descriptor. The generation is bumped every
+    // time a slot is vacated and travels in epoll_event::data next to the
+    // descriptor, so events queued for a previous owner of a reused
+    // descriptor are recognised and dropped.
+    struct Slot
+    {
+        uint32_t generation = 0;
+        std::shared_ptr<EventWorker> eventWorker;
+    };
+
+    // Tags in the low bits of io_uring user data, the rest is the worker
+    enum RingOperation : uint64_t { Accept = 1, Wake = 2, Cancel = 3, Receive = 4, Send = 5, Control = 6 };
+
+    static constexpr uint64_t ringOperationMask = 7;
+
+    // Dispatch flags beside the epoll bits: due EventWorker::after()
+    // timers, and the listener going down
+    static constexpr uint32_t timerEvent = 1u << 24;
+    static constexpr uint32_t stopEvent  = 1u << 25;
+
+    // Timers are created on the loop thread, pool threads hand them over
+    struct TimerRequest
+    {
+        uint64_t key      = 0;
+        uint64_t deadline = 0;
+        std::function<void ()> callback;    // empty for the read deadline
+    };
+
+    static uint64_t makeKey( int fileDescriptor, uint32_t generation );
+    static int keyFileDescriptor( uint64_t key );
+    static uint32_t keyGeneration( uint64_t key );
+
+    Slot* slotOf( uint64_t key );   // null once the connection is gone
+    void wake();
+
+    void accept();
+    void adopt( int fileDescriptor );
+    void control();
+    void drain();
+    void closeStale();
+    void closeAll();
+    void dispatch( const std::shared_ptr<EventWorker>& eventWorker, uint32_t flags );
+    void handle( const std::shared_ptr<EventWorker>& eventWorker,
+                 uint32_t flags,
+                 std::chrono::steady_clock::time_point dispatchedAt );
+    bool resume( EventWorker& eventWorker, bool readable );
+    void rearm( EventWorker& eventWorker, int operation );
+
+    void runRing();
+    void post( uint64_t key );
+    void complete( const io_uring_cqe& completion );
+    void updateRing( const std::shared_ptr<EventWorker>& eventWorker );
+    void submit( const std::shared_ptr<EventWorker>& eventWorker, RingOperation operation );
+    void submitCancel( uint64_t userData );
+    void submitAccept();
+    void submitWakeRead();
+    void submitControlRead();
+
+    void schedule( uint64_t key, uint64_t deadline, std::function<void ()> callback );
+    void startTimers();
+    void armIdleTimer( EventWorker& eventWorker, uint64_t deadline );
+    void armReadTimer( EventWorker& eventWorker, uint64_t deadline );
+    void cancelTimers( EventWorker& eventWorker );
+
+    EventListener& m_eventListener;
+    unsigned m_index = 0;
+
+    int m_socket              = -1;
+    int m_epollFileDescriptor = -1;
+    int m_wakeFileDescriptor  = -1;
+
+    std::atomic<bool> m_running { false };
+    std::atomic<bool> m_stopping { false };
+    bool m_draining = false;
+
+    std::vector<Slot> m_slots;
+    std::shared_ptr<BlockPool> m_eventWorkerPool = std::make_shared<BlockPool>();
+    std::shared_ptr<BufferPool> m_bufferPool     = std::make_shared<BufferPool>();
+
+    EventMetrics m_metrics;
+
+    std::vector<int> m_staleFileDescriptors;
+    std::mutex m_staleFileDescriptorsMutex;
+
+    TimerWheel m_timerWheel;
+    uint64_t m_now = 0;     // wheel tick at the start of the current pass
+    std::vector<TimerRequest> m_timerRequests;
+    std::mutex m_timerRequestsMutex;
+
+    // One wake-up covers every post and timer request until the loop
+    // gets to them
+    std::atomic<bool> m_wakePending { false };
+
+    // io_uring backend, null when running on epoll. Pool threads never
+    // touch the ring: they post worker keys and the loop submits for them.
+    std::unique_ptr<IoRing> m_ring;
+    uint64_t m_wakeValue        = 0;
+    uint64_t m_controlValue     = 0;
+    unsigned m_ringOperations   = 0;    // in flight, accept and wake included
+    std::vector<uint64_t> m_ringRequests;
+    std::mutex m_ringRequestsMutex;
+};
+
+class EventWorker
+{
+public:
+    EventWorker( int fileDescriptor, EventLoop& eventLoop );
+    ~EventWorker();
+
+    int fileDescriptor() const;
+    bool isClosed() const;
+
+    void close();
+
+    // Queues the data; it is sent once the current handler returns, or
+    // right away when called from outside a handler. Returns false, and
+    // drops the connection, once the peer is too far behind.
+    bool write( std::string_view data );
+
+    // Same as write() with the listener's framing applied to the data
+    bool writeFrame( std::string_view data );
+
+    // Everything received so far. The view stays valid until the next
+    // read() or until the handler returns, whichever comes first.
+    std::string_view read();
+
+    // The complete frames received so far; a partial frame stays buffered
+    // for the next call. An oversized frame drops the connection.
+    const std::vector<std::string_view>& readFrames();
+
+    class ReadAwaiter
+    {
+    public:
+        explicit ReadAwaiter( EventWorker& eventWorker ) : m_eventWorker( eventWorker ) {}
+
+        bool await_ready();
+        void await_suspend( std::coroutine_handle<> continuation );
+        std::string_view await_resume();
+
+    private:
+        EventWorker& m_eventWorker;
+    };
+
+    class FramesAwaiter
+    {
+    public:
+        explicit FramesAwaiter( EventWorker& eventWorker ) : m_eventWorker( eventWorker ) {}
+
+        bool await_ready();
+        void await_suspend( std::coroutine_handle<> continuation );
+        const std::vector<std::string_view>& await_resume();
+
+    private:
+        EventWorker& m_eventWorker;
+    };
+
+    class WriteAwaiter
+    {
+    public:
+        WriteAwaiter( EventWorker& eventWorker, std::string_view data, bool framed )
+            : m_eventWorker( eventWorker ), m_data( data ), m_framed( framed ) {}
+
+        bool await_ready();
+        void await_suspend( std::coroutine_handle<> continuation );
+        bool await_resume();
+
+    private:
+        EventWorker& m_eventWorker;
+        std::string_view m_data;
+        bool m_framed  = false;
+        bool m_written = false;
+    };
+
+    // For connection coroutines. co_await asyncRead() suspends until data
+    // arrives and yields everything received so far, or an empty view once
+    // the peer has closed; asyncReadFrames() does the same for complete
+    // frames. What they yield stays valid until the next read, also across
+    // a co_await on a write. co_await asyncWrite() queues the data and only
+    // suspends while the output is above the high watermark. It yields
+    // false once the connection has been dropped.
+    ReadAwaiter asyncRead();
+    FramesAwaiter asyncReadFrames();
+    WriteAwaiter asyncWrite( std::string_view data );
+    WriteAwaiter asyncWriteFrame( std::string_view data );
+
+    class SleepAwaiter
+    {
+    public:
+        SleepAwaiter( EventWorker& eventWorker, std::chrono::milliseconds delay )
+            : m_eventWorker( eventWorker ), m_delay( delay ) {}
+
+        bool await_ready();
+        void await_suspend( std::coroutine_handle<> continuation );
+        bool await_resume();
+
+    private:
+        EventWorker& m_eventWorker;
+        std::chrono::milliseconds m_delay;
+    };
+
+    // co_await asyncSleep() parks the connection coroutine on the loop's
+    // timer wheel; it yields false when the connection was dropped meanwhile
+    SleepAwaiter asyncSleep( std::chrono::milliseconds delay );
+
+    // Runs the callback on the pool once the delay has passed, never
+    // alongside another handler of this connection. Dropped when the
+    // connection closes first; until then it keeps a half-closed
+    // connection open.
+    void after( std::chrono::milliseconds delay, std::function<void ()> callback );
+
+    // For answers computed off the listener's threads. Taken inside a
+    // handler, a hold keeps a half-closed or draining connection open like
+    // a pending after() timer, and listen() does not tear down before it is
+    // released. release() takes the holder's reference, so that the worker
+    // never outlives its loop.
+    void hold();
+    static void release( std::shared_ptr<EventWorker> eventWorker );
+
+    // Drops the connection unless data arrives within the timeout. Every
+    // arrival clears the deadline, zero clears it as well.
+    void setReadDeadline( std::chrono::milliseconds timeout );
+
+    struct Stats
+    {
+        uint64_t bytesIn   = 0;
+        uint64_t bytesOut  = 0;
+        uint64_t recvCalls = 0;
+        uint64_t sendCalls = 0;
+        std::size_t queuedOutput = 0;
+    };
+
+    Stats stats();
+
+    EventWorker( const EventWorker& )            = delete;
+    EventWorker& operator=( const EventWorker& ) = delete;
+
+private:
+    friend class EventLoop;
+
+    enum class Awaiting { Read, Frames, Write, Sleep };
+
+    // io_uring bookkeeping, touched by the loop thread only
+    struct RingState
+    {
+        bool receiving      = false;
+        bool cancelling     = false;
+        bool sending        = false;
+        unsigned operations = 0;
+        std::shared_ptr<EventWorker> self;  // alive while the kernel holds our memory
+        msghdr message;
+        iovec chunks[64];
+    };
+
+    static constexpr std::size_t maxInbox = 1 << 20;
+
+    bool write( const std::string_view* parts, std::size_t numParts );
+    void receive();
+    bool parseFrames();
+    void finishRead();
+    WriteQueue::FlushResult flush();
+    std::size_t queuedBytes();
+    void suspend( std::coroutine_handle<> continuation, Awaiting awaiting );
+    void destroyContinuation();
+
+    int m_fileDescriptor = -1;
+    uint64_t m_key       = 0;
+    std::atomic<bool> m_closed { false };
+    bool m_peerClosed = false;
+    EventLoop& m_eventLoop;
+
+    ReadBuffer m_readBuffer;
+    std::size_t m_returnedBytes = 0;
+    std::size_t m_scannedBytes  = 0;    // Newline framing: buffered bytes without a '\n'
+    bool m_drained              = false;    // socket emptied since the last EPOLLIN
+    std::vector<std::string_view> m_frames;
+
+    // With io_uring the loop receives ahead of the handler into the inbox
+    ReadBuffer m_inbox;
+    bool m_inboxClosed = false;
+    std::mutex m_inboxMutex;
+    std::unique_ptr<RingState> m_ringState;
+    std::atomic<bool> m_readPaused { false };
+
+    WriteQueue m_writeQueue;
+    std::mutex m_writeMutex;
+
+    std::atomic<uint64_t> m_bytesIn { 0 };
+    std::atomic<uint64_t> m_bytesOut { 0 };
+
+    // Ownership of the EPOLLONESHOT registration: while a job is dispatched
+    // only that job may re-arm the descriptor, events that sneak in
+    // meanwhile are parked in m_pendingEvents and handled by the same job.
+    std::mutex m_stateMutex;
+    bool m_dispatched        = false;
+    bool m_wantWrite         = false;
+    uint32_t m_pendingEvents = 0;
+
+    // The connection coroutine while it is parked on this connection.
+    // Only the dispatched job resumes it, the frame holds a reference
+    // to the worker until it returns or is destroyed on close.
+    std::coroutine_handle<> m_continuation;
+    Awaiting m_awaiting = Awaiting::Read;
+    bool m_sleepExpired = false;
+
+    // after() callbacks whose time has come, run by the dispatched job;
+    // guarded by m_stateMutex
+    std::vector< std::function<void ()> > m_dueCallbacks;
+    std::atomic<unsigned> m_pendingTimers { 0 };
+
+    // In wheel ticks. The timer nodes are touched by the loop thread only.
+    std::atomic<uint64_t> m_lastActivity { 0 };
+    std::atomic<uint64_t> m_readDeadline { 0 };     // 0: none
+    TimerWheel::Timer* m_idleTimer = nullptr;
+    TimerWheel::Timer* m_readTimer = nullptr;
+    std::vector<TimerWheel::Timer*> m_timers;       // after() and asyncSleep()
+};
+
+
+/////////////////////////// ThreadPool class //////////////////////////////
+inline ThreadPool::ThreadPool( unsigned numThreads )
+{
+    for( unsigned i = 0; i < numThreads; i++ )
+        m_queues.emplace_back( new JobQueue );
+
+    for( unsigned i = 0; i < numThreads; i++ )
+        m_threads.emplace_back( &ThreadPool::run, this, i );
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_sleepMutex );
+        m_stopping = true;
+    }
+
+    m_wakeUp.notify_all();
+
+    for( auto&& thread : m_threads )
+        thread.join();
+}
+
+inline unsigned ThreadPool::size() const
+{
+    // The queues are complete before the first thread starts, m_threads is not
+    return static_cast<unsigned>( m_queues.size() );
+}
+
+inline int ThreadPool::pendingJobs() const
+{
+    return m_pendingJobs;
+}
+
+// Index of the pool thread running the caller, -1 outside of any pool
+inline thread_local int currentPoolThread = -1;
+
+inline void ThreadPool::enqueue( std::function<void ()> job )
+{
+    // Jobs submitted from a pool thread stay on its own queue (warm caches),
+    // everything else is spread round-robin; idle threads steal the rest.
+    unsigned index = currentPoolThread >= 0
+                   ? static_cast<unsigned>( currentPoolThread ) % size()
+                   : m_nextQueue++ % size();
+
+    {
+        std::lock_guard<std::mutex> lock( m_queues[index]->mutex );
+        m_queues[index]->jobs.push_back( std::move( job ) );
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( m_sleepMutex );
+        m_pendingJobs++;
+    }
+
+    m_wakeUp.notify_one();
+}
+
+inline void ThreadPool::run( unsigned index )
+{
+    currentPoolThread = static_cast<int>( index );
+
+    {
+        // Leave signal delivery to the thread that owns the event loop
+        sigset_t signals;
+        sigfillset( &signals );
+        pthread_sigmask( SIG_BLOCK, &signals, nullptr );
+    }
+
+    std::function<void ()> job;
+
+    while( 1 )
+    {
+        if( pop( index, job ) || steal( index, job ) )
+        {
+            m_pendingJobs--;
+
+            job();
+            job = nullptr;
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock( m_sleepMutex );
+        m_wakeUp.wait( lock, [this] { return m_stopping || m_pendingJobs > 0; } );
+
+        // Jobs queued before the stop still run
+        if( m_stopping && m_pendingJobs == 0 )
+            break;
+    }
+}
+
+inline bool ThreadPool::pop( unsigned index, std::function<void ()>& job )
+{
+    auto& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock( queue.mutex );
+
+    if( queue.jobs.empty() )
+        return false;
+
+    job = std::move( queue.jobs.front() );
+    queue.jobs.pop_front();
+
+    return true;
+}
+
+inline bool ThreadPool::steal( unsigned index, std::function<void ()>& job )
+{
+    for( unsigned i = 1; i < size(); i++ )
+    {
+        auto& queue = *m_queues[( index + i ) % size()];
+        std::unique_lock<std::mutex> lock( queue.mutex, std::try_to_lock );
+
+        if( !lock.owns_lock() || queue.jobs.empty() )
+            continue;
+
+        job = std::move( queue.jobs.back() );
+        queue.jobs.pop_back();
+
+        return true;
+    }
+
+    return false;
+}
+
+
+/////////////////////////// EventListener class //////////////////////////////
+inline EventListener::EventListener()
+{
+    m_controlFileDescriptor = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if( m_controlFileDescriptor == -1 )
+        throw std::runtime_error( std::string( strerror( errno ) ) );
+}
+
+inline EventListener::~EventListener()
+{
+    // Jobs still queued use the loops, the pool goes first
+    m_threadPool.reset();
+    m_eventLoops.clear();
+
+    ::close( m_controlFileDescriptor );
+}
+
+inline void EventListener::setBacklog( int backlog )
+{
+    m_backlog = backlog;
+}
+
+inline void EventListener::setPort( int port )
+{
+    m_port = port;
+}
+
+inline void EventListener::setThreadCount( unsigned threadCount )
+{
+    m_threadCount = std::max( 1u, threadCount );
+}
+
+inline void EventListener::setReactorCount( unsigned reactorCount )
+{
+    m_reactorCount = std::max( 1u, reactorCount );
+}
+
+inline void EventListener::setCpuAffinity( bool pinReactors )
+{
+    m_pinReactors = pinReactors;
+}
+
+inline void EventListener::setOutputLimits( std::size_t highWatermark, std::size_t maxQueued )
+{
+    m_outputHighWatermark = highWatermark;
+    m_outputMaxQueued     = std::max( highWatermark, maxQueued );
+}
+
+inline void EventListener::setBackend( Backend backend )
+{
+    m_backend = backend;
+}
+
+inline void EventListener::setFraming( Framing framing, std::size_t maxFrameSize )
+{
+    m_framing      = framing;
+    m_maxFrameSize = std::min( maxFrameSize, std::size_t( UINT32_MAX ) );
+}
+
+inline void EventListener::setIdleTimeout( std::chrono::milliseconds timeout )
+{
+    m_idleTimeout = std::max( timeout, std::chrono::milliseconds( 0 ) );
+}
+
+inline void EventListener::setDrainTimeout( std::chrono::milliseconds timeout )
+{
+    m_drainTimeout = std::max( timeout, std::chrono::milliseconds( 0 ) );
+}
+
+inline void EventListener::close()
+{
+    // The first loop passes the stop on to the others
+    m_stopRequested = true;
+    eventfd_write( m_controlFileDescriptor, 1 );
+}
+
+inline void EventListener::listen()
+{
+    {
+        // Lift the soft descriptor limit to the hard one, the listener is
+        // expected to hold tens of thousands of mostly idle connections.
+        rlimit limit;
+
+        if( getrlimit( RLIMIT_NOFILE, &limit ) == 0 && limit.rlim_cur < limit.rlim_max )
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit( RLIMIT_NOFILE, &limit );
+        }
+    }
+
+    // All sockets are bound before any loop runs, so a busy port is
+    // reported here rather than from a reactor thread.
+    for( unsigned i = 0; i < m_reactorCount; i++ )
+    {
+        m_eventLoops.emplace_back( new EventLoop( *this, i ) );
+        m_eventLoops.back()->open( m_reactorCount > 1 );
+    }
+
+    m_threadPool.reset( new ThreadPool( m_threadCount ) );
+
+    // Loop 0 runs on the calling thread, which keeps receiving signals
+    std::vector<std::thread> reactorThreads;
+
+    for( unsigned i = 1; i < m_reactorCount; i++ )
+    {
+        reactorThreads.emplace_back( [this, i]
+        {
+            sigset_t signals;
+            sigfillset( &signals );
+            pthread_sigmask( SIG_BLOCK, &signals, nullptr );
+
+            m_eventLoops[i]->run();
+        } );
+    }
+
+    m_eventLoops[0]->run();
+
+    for( auto&& thread : reactorThreads )
+        thread.join();
+
+    // Holders may still be dropping their references to closed workers
+    for( unsigned holds; ( holds = m_holds ) != 0; )
+        m_holds.wait( holds );
+
+    // Every connection is closed, what is left in the pool are jobs of
+    // closed workers. The loops give back their pooled workers, buffers
+    // and timers last.
+    m_threadPool.reset();
+    m_eventLoops.clear();
+}
+
+
+/////////////////////////// BlockPool class //////////////////////////////
+inline BlockPool::~BlockPool()
+{
+    while( m_freeBlocks )
+    {
+        auto next = m_freeBlocks->next;
+        ::operator delete( m_freeBlocks );
+        m_freeBlocks = next;
+    }
+}
+
+inline void* BlockPool::allocate( std::size_t size )
+{
+    std::size_t blockSize;
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        // The first allocation fixes the block size, so read it under the lock
+        if( m_blockSize == 0 )
+            m_blockSize = std::max( size, sizeof( FreeBlock ) );
+
+        blockSize = m_blockSize;
+
+        if( size <= blockSize && m_freeBlocks )
+        {
+            auto block   = m_freeBlocks;
+            m_freeBlocks = block->next;
+            return block;
+        }
+    }
+
+    return ::operator new( size <= blockSize ? blockSize : size );
+}
+
+inline void BlockPool::deallocate( void* block, std::size_t size )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        if( size <= m_blockSize )
+        {
+            auto freeBlock  = static_cast<FreeBlock*>( block );
+            freeBlock->next = m_freeBlocks;
+            m_freeBlocks    = freeBlock;
+            return;
+        }
+    }
+
+    ::operator delete( block );
+}
+
+
+inline void EventListener::dumpStats( std::ostream& os ) const
+{
+    uint64_t accepts = 0, closes = 0, dispatches = 0, bytesIn = 0, bytesOut = 0, framesIn = 0;
+    uint64_t recvCalls = 0, sendCalls = 0, epollWaits = 0, timersFired = 0, timeouts = 0;
+    int64_t queuedOutput = 0;
+
+    LatencyHistogram dispatchDelay;
+    LatencyHistogram handlerTime;
+
+    for( auto&& eventLoop : m_eventLoops )
+    {
+        auto& metrics = eventLoop->m_metrics;
+
+        accepts      += metrics.accepts;
+        closes       += metrics.closes;
+        dispatches   += metrics.dispatches;
+        bytesIn      += metrics.bytesIn;
+        bytesOut     += metrics.bytesOut;
+        framesIn     += metrics.framesIn;
+        recvCalls    += metrics.recvCalls;
+        sendCalls    += metrics.sendCalls;
+        epollWaits   += metrics.epollWaits;
+        timersFired  += metrics.timersFired;
+        timeouts     += metrics.timeouts;
+        queuedOutput += metrics.queuedOutput;
+
+        dispatchDelay.merge( metrics.dispatchDelay );
+        handlerTime.merge( metrics.handlerTime );
+    }
+
+    auto printLatency = [&os] ( const char* name, const LatencyHistogram& histogram )
+    {
+        os << "  " << name << " (us): count " << histogram.count()
+           << ", mean " << histogram.mean() / 1000.0
+           << ", p50 " << histogram.percentile( 0.5 ) / 1000.0
+           << ", p99 " << histogram.percentile( 0.99 ) / 1000.0
+           << ", p999 " << histogram.percentile( 0.999 ) / 1000.0
+           << ", max " << histogram.max() / 1000.0 << std::endl;
+    };
+
+    bool ring = !m_eventLoops.empty() && m_eventLoops[0]->m_ring;
+
+    os << "EventListener stats (" << m_eventLoops.size() << " reactors, "
+       << ( ring ? "io_uring" : "epoll" ) << ")" << std::endl;
+    os << "  connections: open " << accepts - closes << ", accepted " << accepts << ", closed " << closes << std::endl;
+    os << "  bytes: in " << bytesIn << ", out " << bytesOut << ", frames in " << framesIn << std::endl;
+    os << "  syscalls: recv " << recvCalls << ", send " << sendCalls
+       << ", " << ( ring ? "io_uring_enter " : "epoll_wait " ) << epollWaits << std::endl;
+    os << "  queues: dispatches " << dispatches
+       << ", pending jobs " << ( m_threadPool ? m_threadPool->pendingJobs() : 0 )
+       << ", queued output bytes " << queuedOutput << std::endl;
+    os << "  timers: fired " << timersFired << ", timed out connections " << timeouts << std::endl;
+
+    printLatency( "dispatch delay", dispatchDelay );
+    printLatency( "handler time", handlerTime );
+}
+
+inline void EventListener::requestStatsDump()
+{
+    m_statsRequested = true;
+    eventfd_write( m_controlFileDescriptor, 1 );
+}
+
+
+/////////////////////////// EventLoop class //////////////////////////////
+inline EventLoop::EventLoop( EventListener& eventListener, unsigned index )
+    : m_eventListener( eventListener )
+    , m_index( index )
+{
+}
+
+inline EventLoop::~EventLoop()
+{
+    closeAll();
+
+    if( m_socket != -1 )
+        ::close( m_socket );
+
+    if( m_epollFileDescriptor != -1 )
+        ::close( m_epollFileDescriptor );
+
+    if( m_wakeFileDescriptor != -1 )
+        ::close( m_wakeFileDescriptor );
+}
+
+inline void EventLoop::open( bool reusePort )
+{
+    m_socket = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+    if( m_socket == -1 )
+        throw std::runtime_error( std::string( strerror( errno ) ) );
+
+    {
+        int option = 1;
+
+        setsockopt( m_socket,
+                    SOL_SOCKET,
+                    SO_REUSEADDR,
+                    reinterpret_cast<const void*>( &option ),
+                    sizeof( option ) );
+
+        if( reusePort )
+        {
+            int result = setsockopt( m_socket,
+                                     SOL_SOCKET,
+                                     SO_REUSEPORT,
+                                     reinterpret_cast<const void*>( &option ),
+                                     sizeof( option ) );
+
+            if( result == -1 )
+                throw std::runtime_error( std::string( strerror( errno ) ) );
+        }
+    }
+
+    sockaddr_in socketAddress;
+
+    std::fill( reinterpret_cast<char*>( &socketAddress ),
+               reinterpret_cast<char*>( &socketAddress ) + sizeof( socketAddress ),
+               0 );
+
+    socketAddress.sin_family      = AF_INET;
+    socketAddress.sin_addr.s_addr = htonl( INADDR_ANY );
+    socketAddress.sin_port        = htons( m_eventListener.m_port );
+
+    {
+        auto result = bind( m_socket,
+                            reinterpret_cast<const sockaddr*>( &socketAddress ),
+                            sizeof( socketAddress ) );
+
+        if( result == -1 )
+            throw std::runtime_error( std::string( strerror( errno ) ) );
+    }
+
+    {
+        int result = ::listen( m_socket, m_eventListener.m_backlog );
+
+        if( result == -1 )
+            throw std::runtime_error( std::string( strerror( errno ) ) );
+    }
+
+    m_epollFileDescriptor = epoll_create1( EPOLL_CLOEXEC );
+
+    if( m_epollFileDescriptor == -1 )
+        throw std::runtime_error( std::string( strerror( errno ) ) );
+
+    m_wakeFileDescriptor = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if( m_wakeFileDescriptor == -1 )
+        throw std::runtime_error( std::string( strerror( errno ) ) );
+
+    {
+        epoll_event event;
+        event.events   = EPOLLIN | EPOLLET;
+        event.data.u64 = makeKey( m_socket, 0 );
+
+        int result = epoll_ctl( m_epollFileDescriptor, EPOLL_CTL_ADD, m_socket, &event );
+
+        if( result == -1 )
+            throw std::runtime_error( std::string( strerror( errno ) ) );
+
+        event.data.u64 = makeKey( m_wakeFileDescriptor, 0 );
+
+        result = epoll_ctl( m_epollFileDescriptor, EPOLL_CTL_ADD, m_wakeFileDescriptor, &event );
+
+        if( result == -1 )
+            throw std::runtime_error( std::string( strerror( errno ) ) );
+
+        // Requests made before the loop runs are reported right away
+        if( m_index == 0 )
+        {
+            event.data.u64 = makeKey( m_eventListener.m_controlFileDescriptor, 0 );
+
+            result = epoll_ctl( m_epollFileDescriptor,
+                                EPOLL_CTL_ADD,
+                                m_eventListener.m_controlFileDescriptor,
+                                &event );
+
+            if( result == -1 )
+                throw std::runtime_error( std::string( strerror( errno ) ) );
+        }
+    }
+
+    if( m_eventListener.m_backend == EventListener::Backend::IoUring )
+    {
+        // 512 provided buffers of 16 KiB shared by all connections of the loop
+        try
+        {
+            m_ring.reset( new IoRing( 4096, 512, 16384 ) );
+        }
+        catch( const std::exception& e )
+        {
+            if( m_index == 0 )
+                std::cerr << "io_uring unavailable (" << e.what() << "), using epoll" << std::endl;
+        }
+    }
+
+    m_running = true;
+}
+
+inline void EventLoop::run()
+{
+    if( m_eventListener.m_pinReactors )
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        CPU_SET( m_index % std::max( 1u, std::thread::hardware_concurrency() ), &cpuSet );
+
+        pthread_setaffinity_np( pthread_self(), sizeof( cpuSet ), &cpuSet );
+    }
+
+    m_slots.resize( 1024 );
+
+    if( m_ring )
+    {
+        runRing();
+        return;
+    }
+
+    // Only the ready descriptors come back from epoll_wait, so this bounds
+    // the batch size per wakeup, not the number of connections.
+    std::vector<epoll_event> readyEvents( 1024 );
+
+    while( 1 )
+    {
+        // Sleeps until the next timer is due at the latest
+        int numFileDescriptors = epoll_wait( m_epollFileDescriptor,
+                                             readyEvents.data(),
+                                             static_cast<int>( readyEvents.size() ),
+                                             m_timerWheel.timeout( m_timerWheel.now() ) );
+
+        m_metrics.epollWaits.fetch_add( 1, std::memory_order_relaxed );
+
+        if( numFileDescriptors == -1 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            break;
+        }
+
+        m_now = m_timerWheel.now();
+
+        for( int n = 0; n < numFileDescriptors; n++ )
+        {
+            uint64_t key   = readyEvents[n].data.u64;
+            uint32_t flags = readyEvents[n].events;
+            int i          = keyFileDescriptor( key );
+
+            // Woken up by close( fileDescriptor ), a timer request or a
+            // stop
+            if( i == m_wakeFileDescriptor )
+            {
+                eventfd_t value;
+                eventfd_read( m_wakeFileDescriptor, &value );
+                m_wakePending = false;
+                continue;
+            }
+
+            if( m_index == 0 && i == m_eventListener.m_controlFileDescriptor )
+            {
+                eventfd_t value;
+                eventfd_read( m_eventListener.m_controlFileDescriptor, &value );
+                control();
+                continue;
+            }
+
+            // Handle new clients
+            if( i == m_socket )
+            {
+                accept();
+                continue;
+            }
+
+            // Known client socket
+            auto& slot = m_slots[i];
+
+            if( !slot.eventWorker || slot.generation != keyGeneration( key ) )
+                continue;
+
+            dispatch( slot.eventWorker, flags );
+        }
+
+        startTimers();
+        m_timerWheel.advance( m_now );
+
+        closeStale();
+
+        if( m_stopping && !m_draining )
+            drain();
+
+        if( m_draining && m_metrics.accepts == m_metrics.closes )
+            break;
+    }
+
+    m_running = false;
+
+    if( m_socket != -1 )
+    {
+        epoll_ctl( m_epollFileDescriptor, EPOLL_CTL_DEL, m_socket, nullptr );
+        ::close( m_socket );
+        m_socket = -1;
+    }
+
+    closeAll();
+}
+
+inline void EventLoop::stop()
+{
+    // The loop thread closes the listening socket and drains the
+    // connections itself once it sees the flag
+    m_stopping = true;
+    wake();
+}
+
+inline void EventLoop::close( int fileDescriptor )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_staleFileDescriptorsMutex );
+        m_staleFileDescriptors.push_back( fileDescriptor );
+    }
+
+    if( m_wakeFileDescriptor != -1 )
+        eventfd_write( m_wakeFileDescriptor, 1 );
+}
+
+inline std::shared_ptr<BufferPool> EventLoop::bufferPool() const
+{
+    return m_bufferPool;
+}
+
+inline uint64_t EventLoop::makeKey( int fileDescriptor, uint32_t generation )
+{
+    return ( uint64_t( generation ) << 32 ) | uint32_t( fileDescriptor );
+}
+
+inline int EventLoop::keyFileDescriptor( uint64_t key )
+{
+    return int( uint32_t( key ) );
+}
+
+inline uint32_t EventLoop::keyGeneration( uint64_t key )
+{
+    return uint32_t( key >> 32 );
+}
+
+inline EventLoop::Slot* EventLoop::slotOf( uint64_t key )
+{
+    auto i = std::size_t( keyFileDescriptor( key ) );
+
+    if( i >= m_slots.size() || !m_slots[i].eventWorker || m_slots[i].generation != keyGeneration( key ) )
+        return nullptr;
+
+    return &m_slots[i];
+}
+
+inline void EventLoop::wake()
+{
+    if( !m_wakePending.exchange( true ) )
+        eventfd_write( m_wakeFileDescriptor, 1 );
+}
+
+inline void EventLoop::accept()
+{
+    // Edge-triggered: drain the accept queue
+    while( 1 )
+    {
+        sockaddr_in clientAddress;
+        socklen_t clientAddressLength = sizeof( clientAddress );
+
+        int clientFileDescriptor = accept4( m_socket,
+                                            reinterpret_cast<sockaddr*>( &clientAddress ),
+                                            &clientAddressLength,
+                                            SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+        if( clientFileDescriptor == -1 )
+            break;
+
+        adopt( clientFileDescriptor );
+    }
+}
+
+inline void EventLoop::adopt( int clientFileDescriptor )
+{
+    if( std::size_t( clientFileDescriptor ) >= m_slots.size() )
+        m_slots.resize( std::max( m_slots.size() * 2, std::size_t( clientFileDescriptor ) + 1 ) );
+
+    auto& slot = m_slots[clientFileDescriptor];
+
+    slot.eventWorker = std::allocate_shared<EventWorker>( PoolAllocator<EventWorker>( m_eventWorkerPool ),
+                                                          clientFileDescriptor,
+                                                          *this );
+
+    auto eventWorker = slot.eventWorker;
+
+    eventWorker->m_key = makeKey( clientFileDescriptor, slot.generation );
+
+    if( m_ring )
+        eventWorker->m_ringState.reset( new EventWorker::RingState );
+
+    if( m_eventListener.m_idleTimeout.count() > 0 )
+    {
+        eventWorker->m_lastActivity = m_now;
+        armIdleTimer( *eventWorker, m_now + uint64_t( m_eventListener.m_idleTimeout.count() ) );
+    }
+
+    m_metrics.accepts.fetch_add( 1, std::memory_order_relaxed );
+
+    // The ring receives ahead of the handlers, what arrives while the
+    // accept job runs is queued as a pending event
+    if( m_ring )
+        updateRing( eventWorker );
+
+    // The descriptor is only armed once onAccept has returned, or the
+    // connection coroutine has first suspended, so handlers of one
+    // connection never overlap.
+    if( m_eventListener.m_handleAccept || m_eventListener.m_handleConnection )
+    {
+        eventWorker->m_dispatched = true;
+
+        auto dispatchedAt = std::chrono::steady_clock::now();
+
+        m_eventListener.m_threadPool->enqueue( [this, eventWorker, dispatchedAt]
+        {
+            handle( eventWorker, 0, dispatchedAt );
+        } );
+    }
+    else if( !m_ring )
+    {
+        rearm( *eventWorker, EPOLL_CTL_ADD );
+    }
+
+    // Taken off the backlog while stopping: served and closed like the rest
+    if( m_draining )
+        dispatch( eventWorker, EPOLLIN | stopEvent );
+}
+
+inline void EventLoop::control()
+{
+    // First loop only: requests made on the listener, maybe from a signal
+    // handler
+    if( m_eventListener.m_statsRequested.exchange( false ) )
+        m_eventListener.dumpStats( std::cerr );
+
+    if( m_eventListener.m_stopRequested )
+    {
+        for( auto&& eventLoop : m_eventListener.m_eventLoops )
+            eventLoop->stop();
+    }
+}
+
+inline void EventLoop::drain()
+{
+    // Connections still waiting in the backlog are taken along, then the
+    // port is given up. Everyone else finishes what has arrived and
+    // closes once the output has gone out.
+    m_draining = true;
+
+    if( m_ring )
+        submitCancel( Accept );
+    else
+        epoll_ctl( m_epollFileDescriptor, EPOLL_CTL_DEL, m_socket, nullptr );
+
+    accept();
+
+    ::close( m_socket );
+    m_socket = -1;
+
+    for( auto&& slot : m_slots )
+    {
+        if( slot.eventWorker && !slot.eventWorker->isClosed() )
+            dispatch( slot.eventWorker, EPOLLIN | stopEvent );
+    }
+
+    auto timeout = uint64_t( m_eventListener.m_drainTimeout.count() );
+
+    if( timeout == 0 )
+    {
+        closeAll();
+        return;
+    }
+
+    m_timerWheel.schedule( m_now + timeout, [this] ( TimerWheel::Timer* ) { closeAll(); } );
+}
+
+inline void EventLoop::closeStale()
+{
+    std::lock_guard<std::mutex> lock( m_staleFileDescriptorsMutex );
+
+    for( auto&& fileDescriptor : m_staleFileDescriptors )
+    {
+        if( std::size_t( fileDescriptor ) >= m_slots.size() )
+            continue;
+
+        auto& slot = m_slots[fileDescriptor];
+
+        // Already vacated, the descriptor number may belong to someone else
+        if( !slot.eventWorker )
+            continue;
+
+        // A parked coroutine is destroyed here unless a job is dispatched,
+        // that job sees the closed worker and destroys it instead
+        bool idle = false;
+        {
+            std::lock_guard<std::mutex> lock( slot.eventWorker->m_stateMutex );
+            idle = !slot.eventWorker->m_dispatched;
+        }
+
+        if( idle )
+            slot.eventWorker->destroyContinuation();
+
+        cancelTimers( *slot.eventWorker );
+
+        // Cancelled by user data, not by descriptor, as the number may be
+        // reused before the cancellations are submitted. The worker stays
+        // alive until the kernel has completed them.
+        if( m_ring )
+        {
+            auto& ringState = *slot.eventWorker->m_ringState;
+            auto userData   = reinterpret_cast<uint64_t>( slot.eventWorker.get() );
+
+            if( ringState.receiving && !ringState.cancelling )
+            {
+                submitCancel( userData | Receive );
+                ringState.cancelling = true;
+            }
+
+            if( ringState.sending )
+                submitCancel( userData | Send );
+        }
+        else
+        {
+            epoll_ctl( m_epollFileDescriptor, EPOLL_CTL_DEL, fileDescriptor, nullptr );
+        }
+
+        slot.eventWorker.reset();
+        slot.generation++;
+
+        m_metrics.closes.fetch_add( 1, std::memory_order_relaxed );
+
+        // Only shut down: the number stays ours until the worker is gone,
+        // so a writer or reader on another thread that passed its m_closed
+        // check cannot reach a newly accepted connection
+        ::shutdown( fileDescriptor, SHUT_RDWR );
+    }
+
+    m_staleFileDescriptors.clear();
+}
+
+inline void EventLoop::closeAll()
+{
+    for( auto&& slot : m_slots )
+    {
+        if( slot.eventWorker )
+            slot.eventWorker->close();
+    }
+
+    closeStale();
+}
+
+inline void EventLoop::dispatch( const std::shared_ptr<EventWorker>& eventWorker, uint32_t flags )
+{
+    eventWorker->m_lastActivity.store( m_now, std::memory_order_relaxed );
+
+    {
+        std::lock_guard<std::mutex> lock( eventWorker->m_stateMutex );
+
+        if( eventWorker->m_dispatched )
+        {
+            eventWorker->m_pendingEvents |= flags;
+            return;
+        }
+
+        eventWorker->m_dispatched = true;
+    }
+
+    m_metrics.dispatches.fetch_add( 1, std::memory_order_relaxed );
+
+    auto dispatchedAt = std::chrono::steady_clock::now();
+
+    // The descriptor is registered EPOLLONESHOT: it stays disarmed until the
+    // job below re-arms it, so one connection is never handled by two pool
+    // threads at once while different connections overlap freely.
+    m_eventListener.m_threadPool->enqueue( [this, eventWorker, flags, dispatchedAt]
+    {
+        handle( eventWorker, flags, dispatchedAt );
+    } );
+}
+
+inline void EventLoop::handle( const std::shared_ptr<EventWorker>& eventWorker,
+                               uint32_t flags,
+                               std::chrono::steady_clock::time_point dispatchedAt )
+{
+    auto elapsedSince = [] ( std::chrono::steady_clock::time_point start )
+    {
+        return uint64_t( std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start ).count() );
+    };
+
+    m_metrics.dispatchDelay.record( elapsedSince( dispatchedAt ) );
+
+    // flags == 0 is the job that runs onAccept, or starts the connection
+    // coroutine, before the first arm
+    int operation = flags ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    bool coroutine = bool( m_eventListener.m_handleConnection );
+
+    if( !flags && m_eventListener.m_handleAccept )
+    {
+        auto start = std::chrono::steady_clock::now();
+        m_eventListener.m_handleAccept( eventWorker );
+        m_metrics.handlerTime.record( elapsedSince( start ) );
+    }
+
+    if( !flags && coroutine && !eventWorker->isClosed() )
+    {
+        auto start = std::chrono::steady_clock::now();
+        m_eventListener.m_handleConnection( eventWorker );
+        m_metrics.handlerTime.record( elapsedSince( start ) );
+
+        // Returned without ever suspending
+        if( !eventWorker->m_continuation )
+            eventWorker->m_peerClosed = true;
+    }
+
+    while( 1 )
+    {
+        if( flags & ( EPOLLERR | EPOLLHUP ) )
+        {
+            eventWorker->close();
+            eventWorker->destroyContinuation();
+            return;
+        }
+
+        // Due after() timers; what they write goes out with the flush below
+        if( flags & timerEvent )
+        {
+            std::vector< std::function<void ()> > callbacks;
+            {
+                std::lock_guard<std::mutex> lock( eventWorker->m_stateMutex );
+                callbacks.swap( eventWorker->m_dueCallbacks );
+            }
+
+            for( auto&& callback : callbacks )
+            {
+                if( !eventWorker->isClosed() )
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    callback();
+                    m_metrics.handlerTime.record( elapsedSince( start ) );
+                }
+
+                eventWorker->m_pendingTimers--;
+            }
+        }
+
+        if( ( flags & EPOLLIN ) && !eventWorker->m_peerClosed && !eventWorker->isClosed() )
+        {
+            eventWorker->m_drained = false;
+
+            // The handler is only called for new data, which is received
+            // here so that its first read() needs no system call
+            if( coroutine )
+            {
+                resume( *eventWorker, true );
+            }
+            else if( m_eventListener.m_framing != EventListener::Framing::Raw )
+            {
+                auto& frames = eventWorker->readFrames();
+
+                if( !frames.empty() && m_eventListener.m_handleFrames )
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    m_eventListener.m_handleFrames( eventWorker, frames );
+                    m_metrics.handlerTime.record( elapsedSince( start ) );
+                }
+            }
+            else
+            {
+                eventWorker->receive();
+
+                if( eventWorker->m_readBuffer.size() > 0 && m_eventListener.m_handleRead )
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    m_eventListener.m_handleRead( eventWorker );
+                    m_metrics.handlerTime.record( elapsedSince( start ) );
+                }
+            }
+
+            eventWorker->finishRead();
+        }
+
+        // Edge-triggered: the hang-up will not be reported again
+        // once the handler has drained the remaining bytes. A stopping
+        // listener reads no further either.
+        if( flags & ( EPOLLRDHUP | stopEvent ) )
+            eventWorker->m_peerClosed = true;
+
+        if( eventWorker->isClosed() )
+        {
+            eventWorker->destroyContinuation();
+            return;
+        }
+
+        // One flush per dispatch sends everything the handler wrote
+        auto result = eventWorker->flush();
+
+        if( result == WriteQueue::FlushResult::Failed )
+        {
+            eventWorker->close();
+            eventWorker->destroyContinuation();
+            return;
+        }
+
+        // A coroutine parked on back-pressure continues once the flush got
+        // the output below the watermark, one parked on an empty buffer
+        // learns that the peer has closed. Whatever it writes is flushed
+        // on the next pass.
+        if( coroutine && resume( *eventWorker, false ) )
+        {
+            eventWorker->finishRead();
+            flags = 0;
+            continue;
+        }
+
+        // A pending timer still has something to say to a half-closed peer
+        if( result == WriteQueue::FlushResult::Drained &&
+            eventWorker->m_peerClosed &&
+            eventWorker->m_pendingTimers == 0 )
+        {
+            eventWorker->close();
+            eventWorker->destroyContinuation();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock( eventWorker->m_stateMutex );
+
+        if( eventWorker->m_pendingEvents )
+        {
+            flags = eventWorker->m_pendingEvents;
+            eventWorker->m_pendingEvents = 0;
+            continue;
+        }
+
+        eventWorker->m_wantWrite  = ( result == WriteQueue::FlushResult::Pending );
+        eventWorker->m_dispatched = false;
+
+        // The ring sends on its own, a send completion only needs to come
+        // back here when something waits for the output to drain
+        if( m_ring )
+        {
+            eventWorker->m_wantWrite = eventWorker->m_wantWrite &&
+                                       ( eventWorker->m_peerClosed ||
+                                         ( eventWorker->m_continuation &&
+                                           eventWorker->m_awaiting == EventWorker::Awaiting::Write ) );
+        }
+
+        rearm( *eventWorker, operation );
+        return;
+    }
+}
+
+inline bool EventLoop::resume( EventWorker& eventWorker, bool readable )
+{
+    // Called from the dispatched job only. Resumes the parked coroutine if
+    // what it waits for is there, returns whether it ran.
+    if( !eventWorker.m_continuation )
+        return false;
+
+    if( eventWorker.m_awaiting == EventWorker::Awaiting::Sleep )
+    {
+        if( !eventWorker.m_sleepExpired && !eventWorker.isClosed() )
+            return false;
+    }
+    else if( eventWorker.m_awaiting != EventWorker::Awaiting::Write )
+    {
+        bool ready = eventWorker.isClosed() || eventWorker.m_peerClosed;
+
+        if( !ready && readable )
+        {
+            if( eventWorker.m_awaiting == EventWorker::Awaiting::Read )
+                ready = !eventWorker.read().empty();
+            else
+                ready = !eventWorker.readFrames().empty();
+
+            ready = ready || eventWorker.m_peerClosed || eventWorker.isClosed();
+        }
+
+        if( !ready )
+            return false;
+    }
+    else if( !eventWorker.isClosed() && eventWorker.queuedBytes() >= m_eventListener.m_outputHighWatermark )
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> continuation;
+    {
+        std::lock_guard<std::mutex> lock( eventWorker.m_stateMutex );
+        continuation = std::exchange( eventWorker.m_continuation, nullptr );
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    continuation.resume();
+    m_metrics.handlerTime.record( uint64_t( std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                std::chrono::steady_clock::now() - start ).count() ) );
+
+    // The coroutine returned: stop reading and close once the output has
+    // drained, as after a half-close
+    if( !eventWorker.m_continuation )
+        eventWorker.m_peerClosed = true;
+
+    return true;
+}
+
+inline void EventLoop::rearm( EventWorker& eventWorker, int operation )
+{
+    // Called with eventWorker.m_stateMutex held (or before the worker is
+    // published). Reading pauses while the peer lags behind on output and
+    // stops once it has shut its side down.
+    if( m_ring )
+    {
+        // Nothing to arm, the loop only needs to hear about output and
+        // about reading that it has paused
+        if( eventWorker.m_wantWrite || eventWorker.m_readPaused || eventWorker.queuedBytes() > 0 )
+            post( eventWorker.m_key );
+
+        return;
+    }
+
+    uint32_t events = EPOLLET | EPOLLONESHOT;
+
+    if( !eventWorker.m_peerClosed )
+    {
+        events |= EPOLLRDHUP;
+
+        if( eventWorker.queuedBytes() < m_eventListener.m_outputHighWatermark )
+            events |= EPOLLIN;
+    }
+
+    if( eventWorker.m_wantWrite )
+        events |= EPOLLOUT;
+
+    epoll_event event;
+    event.events   = events;
+    event.data.u64 = eventWorker.m_key;
+
+    if( epoll_ctl( m_epollFileDescriptor, operation, keyFileDescriptor( eventWorker.m_key ), &event ) == -1 )
+        eventWorker.close();
+}
+
+inline void EventLoop::runRing()
+{
+    // Every request goes out with the next wait, so the sends, receive
+    // re-arms and cancellations of one pass share a single io_uring_enter.
+    m_ring->enable();
+
+    submitAccept();
+    submitWakeRead();
+
+    if( m_index == 0 )
+        submitControlRead();
+
+    std::vector<uint64_t> requests;
+
+    while( 1 )
+    {
+        int result = m_ring->submitAndWait( m_timerWheel.timeout( m_timerWheel.now() ) );
+
+        m_metrics.epollWaits.fetch_add( 1, std::memory_order_relaxed );
+
+        if( result == -1 && errno != EINTR && errno != EBUSY && errno != ETIME )
+            break;
+
+        m_now = m_timerWheel.now();
+
+        m_ring->forEachCompletion( [this] ( const io_uring_cqe& completion )
+        {
+            complete( completion );
+        } );
+
+        // Posted by pool threads: output to send, reading to resume
+        {
+            std::lock_guard<std::mutex> lock( m_ringRequestsMutex );
+            requests.swap( m_ringRequests );
+        }
+
+        for( auto&& key : requests )
+        {
+            if( auto slot = slotOf( key ) )
+                updateRing( slot->eventWorker );
+        }
+
+        requests.clear();
+
+        startTimers();
+        m_timerWheel.advance( m_now );
+
+        closeStale();
+
+        if( m_stopping && !m_draining )
+            drain();
+
+        if( m_draining && m_metrics.accepts == m_metrics.closes )
+            break;
+    }
+
+    m_running = false;
+
+    if( m_socket != -1 )
+    {
+        submitCancel( Accept );
+        ::close( m_socket );
+        m_socket = -1;
+    }
+
+    submitCancel( Wake );
+
+    if( m_index == 0 )
+        submitCancel( Control );
+
+    closeAll();
+
+    // The kernel may still write into workers and buffers, wait until it
+    // has handed everything back
+    while( m_ringOperations > 0 )
+    {
+        if( m_ring->submitAndWait() == -1 && errno != EINTR )
+            break;
+
+        m_ring->forEachCompletion( [this] ( const io_uring_cqe& completion )
+        {
+            complete( completion );
+        } );
+    }
+}
+
+inline void EventLoop::post( uint64_t key )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_ringRequestsMutex );
+        m_ringRequests.push_back( key );
+    }
+
+    wake();
+}
+
+inline void EventLoop::complete( const io_uring_cqe& completion )
+{
+    auto operation = RingOperation( completion.user_data & ringOperationMask );
+    bool more      = completion.flags & IORING_CQE_F_MORE;
+    int result     = completion.res;
+
+    if( operation == Accept )
+    {
+        if( result >= 0 )
+        {
+            if( m_running )
+                adopt( result );
+            else
+                ::close( result );
+        }
+
+        if( !more )
+        {
+            m_ringOperations--;
+            submitAccept();
+        }
+
+        return;
+    }
+
+    if( operation == Wake )
+    {
+        m_ringOperations--;
+        m_wakePending = false;
+
+        submitWakeRead();
+        return;
+    }
+
+    if( operation == Control )
+    {
+        m_ringOperations--;
+
+        control();
+
+        submitControlRead();
+        return;
+    }
+
+    if( operation == Cancel )
+    {
+        m_ringOperations--;
+        return;
+    }
+
+    auto* worker     = reinterpret_cast<EventWorker*>( completion.user_data & ~ringOperationMask );
+    auto& ringState  = *worker->m_ringState;
+    auto eventWorker = ringState.self;  // the last reference may go below
+
+    if( operation == Receive )
+    {
+        if( result > 0 )
+        {
+            unsigned bufferId = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+
+            {
+                std::lock_guard<std::mutex> lock( eventWorker->m_inboxMutex );
+                eventWorker->m_inbox.append( m_ring->buffer( bufferId ), result );
+            }
+
+            m_ring->recycle( bufferId );
+
+            eventWorker->m_bytesIn.fetch_add( result, std::memory_order_relaxed );
+            m_metrics.bytesIn.fetch_add( result, std::memory_order_relaxed );
+        }
+        else if( result == 0 )
+        {
+            std::lock_guard<std::mutex> lock( eventWorker->m_inboxMutex );
+            eventWorker->m_inboxClosed = true;
+        }
+
+        if( !eventWorker->isClosed() )
+        {
+            // Out of provided buffers just ends the multishot, it is
+            // re-armed below
+            if( result >= 0 )
+                dispatch( eventWorker, EPOLLIN );
+            else if( result != -ENOBUFS && result != -ECANCELED )
+                dispatch( eventWorker, EPOLLERR );
+        }
+
+        if( !more )
+        {
+            ringState.receiving  = false;
+            ringState.cancelling = false;
+        }
+    }
+    else
+    {
+        ringState.sending = false;
+
+        if( result > 0 )
+        {
+            std::lock_guard<std::mutex> lock( eventWorker->m_writeMutex );
+            eventWorker->m_writeQueue.consume( result );
+
+            eventWorker->m_bytesOut.fetch_add( result, std::memory_order_relaxed );
+            eventWorker->m_lastActivity.store( m_now, std::memory_order_relaxed );
+            m_metrics.bytesOut.fetch_add( result, std::memory_order_relaxed );
+            m_metrics.queuedOutput.fetch_sub( result, std::memory_order_relaxed );
+        }
+        else if( result < 0 && result != -ECANCELED && !eventWorker->isClosed() )
+        {
+            dispatch( eventWorker, EPOLLERR );
+        }
+    }
+
+    if( !more )
+    {
+        ringState.operations--;
+        m_ringOperations--;
+    }
+
+    updateRing( eventWorker );
+
+    if( operation == Send && !eventWorker->isClosed() )
+    {
+        // Wake a writer held back by the watermark, or a job that waits
+        // for the output to drain before closing
+        bool wantWrite = false;
+        {
+            std::lock_guard<std::mutex> lock( eventWorker->m_stateMutex );
+            wantWrite = eventWorker->m_wantWrite;
+        }
+
+        if( wantWrite && eventWorker->queuedBytes() < m_eventListener.m_outputHighWatermark )
+            dispatch( eventWorker, EPOLLOUT );
+    }
+
+    if( ringState.operations == 0 )
+        ringState.self.reset();
+}
+
+inline void EventLoop::updateRing( const std::shared_ptr<EventWorker>& eventWorker )
+{
+    if( eventWorker->isClosed() )
+        return;
+
+    auto& ringState = *eventWorker->m_ringState;
+    auto queued     = eventWorker->queuedBytes();
+
+    bool inboxFull = false;
+    {
+        std::lock_guard<std::mutex> lock( eventWorker->m_inboxMutex );
+        inboxFull = eventWorker->m_inboxClosed || eventWorker->m_inbox.size() >= EventWorker::maxInbox;
+    }
+
+    // Same back-pressure as the EPOLLIN mask: stop receiving while the
+    // peer lags behind on output or the handler lags behind on input
+    bool wantRead = !inboxFull && queued < m_eventListener.m_outputHighWatermark;
+
+    if( wantRead && !ringState.receiving )
+    {
+        eventWorker->m_readPaused = false;
+        submit( eventWorker, Receive );
+    }
+    else if( !wantRead && ringState.receiving && !ringState.cancelling )
+    {
+        eventWorker->m_readPaused = true;
+        submitCancel( reinterpret_cast<uint64_t>( eventWorker.get() ) | Receive );
+        ringState.cancelling = true;
+    }
+
+    if( queued > 0 && !ringState.sending )
+    {
+        submit( eventWorker, Send );
+    }
+    else if( queued == 0 && !ringState.sending )
+    {
+        // Drained before the job asked for it
+        bool wantWrite = false;
+        {
+            std::lock_guard<std::mutex> lock( eventWorker->m_stateMutex );
+            wantWrite = eventWorker->m_wantWrite && !eventWorker->m_dispatched;
+        }
+
+        if( wantWrite )
+            dispatch( eventWorker, EPOLLOUT );
+    }
+}
+
+inline void EventLoop::submit( const std::shared_ptr<EventWorker>& eventWorker, RingOperation operation )
+{
+    auto& ringState = *eventWorker->m_ringState;
+    auto* entry     = m_ring->prepare();
+
+    entry->fd        = eventWorker->fileDescriptor();
+    entry->user_data = reinterpret_cast<uint64_t>( eventWorker.get() ) | operation;
+
+    if( operation == Receive )
+    {
+        entry->opcode    = IORING_OP_RECV;
+        entry->ioprio    = IORING_RECV_MULTISHOT;
+        entry->flags     = IOSQE_BUFFER_SELECT;
+        entry->buf_group = IoRing::bufferGroup;
+
+        ringState.receiving = true;
+    }
+    else
+    {
+        std::size_t numChunks = 0;
+        {
+            std::lock_guard<std::mutex> lock( eventWorker->m_writeMutex );
+            numChunks = eventWorker->m_writeQueue.gather( ringState.chunks, std::size( ringState.chunks ) );
+        }
+
+        std::fill( reinterpret_cast<char*>( &ringState.message ),
+                   reinterpret_cast<char*>( &ringState.message ) + sizeof( ringState.message ),
+                   0 );
+
+        ringState.message.msg_iov    = ringState.chunks;
+        ringState.message.msg_iovlen = numChunks;
+
+        entry->opcode    = IORING_OP_SENDMSG;
+        entry->addr      = reinterpret_cast<uint64_t>( &ringState.message );
+        entry->len       = 1;
+        entry->msg_flags = MSG_NOSIGNAL;
+
+        ringState.sending = true;
+    }
+
+    if( ringState.operations++ == 0 )
+        ringState.self = eventWorker;
+
+    m_ringOperations++;
+}
+
+inline void EventLoop::submitCancel( uint64_t userData )
+{
+    auto* entry = m_ring->prepare();
+
+    entry->opcode    = IORING_OP_ASYNC_CANCEL;
+    entry->addr      = userData;
+    entry->user_data = Cancel;
+
+    m_ringOperations++;
+}
+
+inline void EventLoop::submitAccept()
+{
+    // Not again once drain() has closed the socket
+    if( !m_running || m_socket == -1 )
+        return;
+
+    auto* entry = m_ring->prepare();
+
+    entry->opcode       = IORING_OP_ACCEPT;
+    entry->fd           = m_socket;
+    entry->ioprio       = IORING_ACCEPT_MULTISHOT;
+    entry->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    entry->user_data    = Accept;
+
+    m_ringOperations++;
+}
+
+inline void EventLoop::submitWakeRead()
+{
+    if( !m_running )
+        return;
+
+    auto* entry = m_ring->prepare();
+
+    entry->opcode    = IORING_OP_READ;
+    entry->fd        = m_wakeFileDescriptor;
+    entry->addr      = reinterpret_cast<uint64_t>( &m_wakeValue );
+    entry->len       = sizeof( m_wakeValue );
+    entry->user_data = Wake;
+
+    m_ringOperations++;
+}
+
+inline void EventLoop::submitControlRead()
+{
+    if( !m_running )
+        return;
+
+    auto* entry = m_ring->prepare();
+
+    entry->opcode    = IORING_OP_READ;
+    entry->fd        = m_eventListener.m_controlFileDescriptor;
+    entry->addr      = reinterpret_cast<uint64_t>( &m_controlValue );
+    entry->len       = sizeof( m_controlValue );
+    entry->user_data = Control;
+
+    m_ringOperations++;
+}
+
+inline void EventLoop::schedule( uint64_t key, uint64_t deadline, std::function<void ()> callback )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_timerRequestsMutex );
+        m_timerRequests.push_back( { key, deadline, std::move( callback ) } );
+    }
+
+    wake();
+}
+
+inline void EventLoop::startTimers()
+{
+    std::vector<TimerRequest> requests;
+    {
+        std::lock_guard<std::mutex> lock( m_timerRequestsMutex );
+        requests.swap( m_timerRequests );
+    }
+
+    for( auto&& request : requests )
+    {
+        auto slot = slotOf( request.key );
+
+        if( !slot || slot->eventWorker->isClosed() )
+            continue;
+
+        auto& eventWorker = *slot->eventWorker;
+
+        if( !request.callback )
+        {
+            armReadTimer( eventWorker, request.deadline );
+            continue;
+        }
+
+        // The worker's timers are cancelled before its slot is vacated, so
+        // the key always finds it here
+        auto key   = request.key;
+        auto timer = m_timerWheel.schedule( request.deadline,
+                                            [this, key, callback = std::move( request.callback )]
+                                            ( TimerWheel::Timer* timer ) mutable
+        {
+            auto& eventWorker = slotOf( key )->eventWorker;
+            auto& timers      = eventWorker->m_timers;
+
+            timers.erase( std::find( timers.begin(), timers.end(), timer ) );
+
+            {
+                std::lock_guard<std::mutex> lock( eventWorker->m_stateMutex );
+                eventWorker->m_dueCallbacks.push_back( std::move( callback ) );
+            }
+
+            m_metrics.timersFired.fetch_add( 1, std::memory_order_relaxed );
+
+            if( !eventWorker->isClosed() )
+                dispatch( eventWorker, timerEvent );
+        } );
+
+        eventWorker.m_timers.push_back( timer );
+    }
+}
+
+inline void EventLoop::armIdleTimer( EventWorker& eventWorker, uint64_t deadline )
+{
+    // Activity only moves m_lastActivity; the timer checks it when it
+    // fires and goes back to sleep for the remainder
+    auto key = eventWorker.m_key;
+
+    eventWorker.m_idleTimer = m_timerWheel.schedule( deadline, [this, key] ( TimerWheel::Timer* )
+    {
+        auto& eventWorker = *slotOf( key )->eventWorker;
+
+        eventWorker.m_idleTimer = nullptr;
+
+        if( eventWorker.isClosed() )
+            return;
+
+        // Neither a running handler nor scheduled work counts as idle
+        bool busy = eventWorker.m_pendingTimers > 0;
+        {
+            std::lock_guard<std::mutex> lock( eventWorker.m_stateMutex );
+            busy = busy || eventWorker.m_dispatched;
+        }
+
+        auto idleTimeout = uint64_t( m_eventListener.m_idleTimeout.count() );
+        auto deadline    = ( busy ? m_now : eventWorker.m_lastActivity.load() ) + idleTimeout;
+
+        if( deadline <= m_now )
+        {
+            m_metrics.timeouts.fetch_add( 1, std::memory_order_relaxed );
+            eventWorker.close();
+            return;
+        }
+
+        armIdleTimer( eventWorker, deadline );
+    } );
+}
+
+inline void EventLoop::armReadTimer( EventWorker& eventWorker, uint64_t deadline )
+{
+    // A timer due earlier re-arms itself for the later deadline
+    if( eventWorker.m_readTimer )
+    {
+        if( eventWorker.m_readTimer->deadline <= deadline )
+            return;
+
+        m_timerWheel.cancel( eventWorker.m_readTimer );
+    }
+
+    auto key = eventWorker.m_key;
+
+    eventWorker.m_readTimer = m_timerWheel.schedule( deadline, [this, key] ( TimerWheel::Timer* )
+    {
+        auto& eventWorker = *slotOf( key )->eventWorker;
+        auto deadline     = eventWorker.m_readDeadline.load();
+
+        eventWorker.m_readTimer = nullptr;
+
+        // Cleared by an arrival or moved by another setReadDeadline()
+        if( deadline == 0 || eventWorker.isClosed() )
+            return;
+
+        if( deadline <= m_now )
+        {
+            m_metrics.timeouts.fetch_add( 1, std::memory_order_relaxed );
+            eventWorker.close();
+            return;
+        }
+
+        armReadTimer( eventWorker, deadline );
+    } );
+}
+
+inline void EventLoop::cancelTimers( EventWorker& eventWorker )
+{
+    m_timerWheel.cancel( eventWorker.m_idleTimer );
+    m_timerWheel.cancel( eventWorker.m_readTimer );
+
+    for( auto&& timer : eventWorker.m_timers )
+        m_timerWheel.cancel( timer );
+
+    eventWorker.m_idleTimer = nullptr;
+    eventWorker.m_readTimer = nullptr;
+    eventWorker.m_timers.clear();
+}
+
+
+/////////////////////////// EventWorker class //////////////////////////////
+inline EventWorker::EventWorker( int fileDescriptor, EventLoop& eventLoop )
+    : m_fileDescriptor( fileDescriptor )
+    , m_eventLoop( eventLoop )
+    , m_readBuffer( eventLoop.bufferPool() )
+    , m_inbox( eventLoop.bufferPool() )
+    , m_writeQueue( eventLoop.bufferPool() )
+{
+}
+
+inline EventWorker::~EventWorker()
+{
+    m_eventLoop.m_metrics.queuedOutput.fetch_sub( m_writeQueue.size(), std::memory_order_relaxed );
+
+    ::close( m_fileDescriptor );
+}
+
+inline int EventWorker::fileDescriptor() const
+{
+    return m_fileDescriptor;
+}
+
+inline bool EventWorker::isClosed() const
+{
+    return m_closed;
+}
+
+inline void EventWorker::close()
+{
+    if( !m_closed.exchange( true ) )
+        m_eventLoop.close( m_fileDescriptor );
+}
+
+inline bool EventWorker::write( std::string_view data )
+{
+    return write( &data, 1 );
+}
+
+inline bool EventWorker::writeFrame( std::string_view data )
+{
+    auto framing = m_eventLoop.m_eventListener.m_framing;
+
+    if( framing == EventListener::Framing::LengthPrefixed )
+    {
+        uint32_t length = htonl( uint32_t( data.size() ) );
+
+        std::string_view parts[2] = { std::string_view( reinterpret_cast<const char*>( &length ), sizeof( length ) ),
+                                      data };
+        return write( parts, 2 );
+    }
+
+    if( framing == EventListener::Framing::Newline )
+    {
+        std::string_view parts[2] = { data, std::string_view( "\n", 1 ) };
+        return write( parts, 2 );
+    }
+
+    return write( &data, 1 );
+}
+
+inline bool EventWorker::write( const std::string_view* parts, std::size_t numParts )
+{
+    if( m_closed )
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock( m_writeMutex );
+
+        std::size_t numBytes = 0;
+
+        for( std::size_t i = 0; i < numParts; i++ )
+            numBytes += parts[i].size();
+
+        if( m_writeQueue.size() + numBytes > m_eventLoop.m_eventListener.m_outputMaxQueued )
+        {
+            this->close();
+            return false;
+        }
+
+        // All parts under one lock, so a frame is never split by another writer
+        for( std::size_t i = 0; i < numParts; i++ )
+            m_writeQueue.append( parts[i] );
+
+        m_eventLoop.m_metrics.queuedOutput.fetch_add( numBytes, std::memory_order_relaxed );
+    }
+
+    // Inside a handler the dispatching job flushes once the handler returns
+    {
+        std::lock_guard<std::mutex> lock( m_stateMutex );
+
+        if( m_dispatched )
+            return true;
+    }
+
+    if( m_eventLoop.m_ring )
+    {
+        m_eventLoop.post( m_key );
+        return true;
+    }
+
+    auto result = flush();
+
+    if( result == WriteQueue::FlushResult::Failed )
+    {
+        this->close();
+        return false;
+    }
+
+    if( result == WriteQueue::FlushResult::Pending )
+    {
+        std::lock_guard<std::mutex> lock( m_stateMutex );
+
+        m_wantWrite = true;
+
+        if( !m_dispatched )
+            m_eventLoop.rearm( *this, EPOLL_CTL_MOD );
+    }
+
+    return true;
+}
+
+inline std::string_view EventWorker::read()
+{
+    m_readBuffer.consume( m_returnedBytes );
+    m_returnedBytes = 0;
+
+    // Bytes not handed out yet were received by the dispatching job
+    if( m_readBuffer.size() == 0 )
+        receive();
+
+    m_returnedBytes = m_readBuffer.size();
+
+    return m_readBuffer.view();
+}
+
+inline const std::vector<std::string_view>& EventWorker::readFrames()
+{
+    m_readBuffer.consume( m_returnedBytes );
+    m_returnedBytes = 0;
+    m_frames.clear();
+
+    // Frames left over from the last receive come first
+    bool valid = parseFrames();
+
+    if( valid && m_frames.empty() && !m_closed && !m_peerClosed )
+    {
+        receive();
+        valid = parseFrames();
+    }
+
+    if( !valid )
+    {
+        m_frames.clear();
+        m_returnedBytes = 0;
+        this->close();
+    }
+
+    return m_frames;
+}
+
+inline void EventWorker::receive()
+{
+    // The loop has received already, only the inbox is left to pick up
+    if( m_eventLoop.m_ring )
+    {
+        std::lock_guard<std::mutex> lock( m_inboxMutex );
+
+        if( m_inbox.size() > 0 && m_readDeadline.load( std::memory_order_relaxed ) )
+            m_readDeadline = 0;
+
+        m_readBuffer.take( m_inbox );
+
+        if( m_inboxClosed )
+            m_peerClosed = true;
+
+        return;
+    }
+
+    auto size     = m_readBuffer.size();
+    auto syscalls = m_readBuffer.syscalls();
+
+    // A short read already emptied the socket, anything that arrives later
+    // is reported by the re-arm
+    if( m_drained )
+        return;
+
+    if( !m_closed && !m_peerClosed && !m_readBuffer.fill( m_fileDescriptor ) )
+        m_peerClosed = true;
+
+    m_drained = true;
+
+    if( m_readBuffer.size() > size && m_readDeadline.load( std::memory_order_relaxed ) )
+        m_readDeadline = 0;
+
+    auto& metrics = m_eventLoop.m_metrics;
+
+    m_bytesIn.fetch_add( m_readBuffer.size() - size, std::memory_order_relaxed );
+    metrics.bytesIn.fetch_add( m_readBuffer.size() - size, std::memory_order_relaxed );
+    metrics.recvCalls.fetch_add( m_readBuffer.syscalls() - syscalls, std::memory_order_relaxed );
+}
+
+inline bool EventWorker::parseFrames()
+{
+    // Collects every complete frame in the buffer into m_frames and marks
+    // the bytes they span as returned. False on a frame above the limit.
+    auto& eventListener = m_eventLoop.m_eventListener;
+    auto data           = m_readBuffer.view();
+    std::size_t offset  = 0;
+
+    if( eventListener.m_framing == EventListener::Framing::LengthPrefixed )
+    {
+        while( data.size() - offset >= sizeof( uint32_t ) )
+        {
+            uint32_t length;
+            std::copy( data.data() + offset, data.data() + offset + sizeof( length ), reinterpret_cast<char*>( &length ) );
+            length = ntohl( length );
+
+            if( length > eventListener.m_maxFrameSize )
+                return false;
+
+            if( data.size() - offset - sizeof( length ) < length )
+                break;
+
+            m_frames.push_back( data.substr( offset + sizeof( length ), length ) );
+            offset += sizeof( length ) + length;
+        }
+    }
+    else
+    {
+        // Resume the search where the previous one gave up
+        std::size_t from = std::min( m_scannedBytes, data.size() );
+
+        while( 1 )
+        {
+            auto end = data.find( '\n', from );
+
+            if( end == std::string_view::npos )
+                break;
+
+            auto frame = data.substr( offset, end - offset );
+
+            if( !frame.empty() && frame.back() == '\r' )
+                frame.remove_suffix( 1 );
+
+            m_frames.push_back( frame );
+            offset = from = end + 1;
+        }
+
+        if( data.size() - offset > eventListener.m_maxFrameSize )
+            return false;
+
+        m_scannedBytes = data.size() - offset;
+    }
+
+    m_returnedBytes = offset;
+    m_eventLoop.m_metrics.framesIn.fetch_add( m_frames.size(), std::memory_order_relaxed );
+
+    return true;
+}
+
+inline EventWorker::ReadAwaiter EventWorker::asyncRead()
+{
+    return ReadAwaiter( *this );
+}
+
+inline EventWorker::FramesAwaiter EventWorker::asyncReadFrames()
+{
+    return FramesAwaiter( *this );
+}
+
+inline EventWorker::WriteAwaiter EventWorker::asyncWrite( std::string_view data )
+{
+    return WriteAwaiter( *this, data, false );
+}
+
+inline EventWorker::WriteAwaiter EventWorker::asyncWriteFrame( std::string_view data )
+{
+    return WriteAwaiter( *this, data, true );
+}
+
+inline EventWorker::SleepAwaiter EventWorker::asyncSleep( std::chrono::milliseconds delay )
+{
+    return SleepAwaiter( *this, delay );
+}
+
+inline void EventWorker::after( std::chrono::milliseconds delay, std::function<void ()> callback )
+{
+    if( m_closed )
+        return;
+
+    m_pendingTimers++;
+    m_eventLoop.schedule( m_key, m_eventLoop.m_timerWheel.deadline( delay ), std::move( callback ) );
+}
+
+inline void EventWorker::hold()
+{
+    m_pendingTimers++;
+    m_eventLoop.m_eventListener.m_holds++;
+}
+
+inline void EventWorker::release( std::shared_ptr<EventWorker> eventWorker )
+{
+    auto& eventLoop     = eventWorker->m_eventLoop;
+    auto& eventListener = eventLoop.m_eventListener;
+
+    // Handed back through a due no-op timer: its dispatch takes the count
+    // and closes a half-closed connection that has nothing left to send
+    eventLoop.schedule( eventWorker->m_key, eventLoop.m_timerWheel.deadline( std::chrono::milliseconds( 0 ) ), [] {} );
+    eventWorker.reset();
+
+    if( --eventListener.m_holds == 0 )
+        eventListener.m_holds.notify_all();
+}
+
+inline void EventWorker::setReadDeadline( std::chrono::milliseconds timeout )
+{
+    if( timeout.count() <= 0 )
+    {
+        m_readDeadline = 0;
+        return;
+    }
+
+    auto deadline = m_eventLoop.m_timerWheel.deadline( timeout );
+
+    m_readDeadline = deadline;
+    m_eventLoop.schedule( m_key, deadline, nullptr );
+}
+
+inline void EventWorker::suspend( std::coroutine_handle<> continuation, Awaiting awaiting )
+{
+    std::lock_guard<std::mutex> lock( m_stateMutex );
+
+    m_continuation = continuation;
+    m_awaiting     = awaiting;
+}
+
+inline void EventWorker::destroyContinuation()
+{
+    std::coroutine_handle<> continuation;
+    {
+        std::lock_guard<std::mutex> lock( m_stateMutex );
+        continuation = std::exchange( m_continuation, nullptr );
+    }
+
+    // May release the last reference to this worker
+    if( continuation )
+        continuation.destroy();
+}
+
+inline WriteQueue::FlushResult EventWorker::flush()
+{
+    std::lock_guard<std::mutex> lock( m_writeMutex );
+
+    // Closed since the caller looked, nothing more goes out
+    if( m_closed )
+        return WriteQueue::FlushResult::Failed;
+
+    // The loop sends for us, batched with the other connections
+    if( m_eventLoop.m_ring )
+        return m_writeQueue.size() ? WriteQueue::FlushResult::Pending : WriteQueue::FlushResult::Drained;
+
+    auto size     = m_writeQueue.size();
+    auto syscalls = m_writeQueue.syscalls();
+    auto result   = m_writeQueue.flush( m_fileDescriptor );
+    auto sent     = size - m_writeQueue.size();
+
+    auto& metrics = m_eventLoop.m_metrics;
+
+    if( sent > 0 )
+        m_lastActivity.store( m_eventLoop.m_timerWheel.now(), std::memory_order_relaxed );
+
+    m_bytesOut.fetch_add( sent, std::memory_order_relaxed );
+    metrics.bytesOut.fetch_add( sent, std::memory_order_relaxed );
+    metrics.queuedOutput.fetch_sub( sent, std::memory_order_relaxed );
+    metrics.sendCalls.fetch_add( m_writeQueue.syscalls() - syscalls, std::memory_order_relaxed );
+
+    return result;
+}
+
+inline EventWorker::Stats EventWorker::stats()
+{
+    Stats stats;
+    stats.bytesIn   = m_bytesIn;
+    stats.bytesOut  = m_bytesOut;
+    stats.recvCalls = m_readBuffer.syscalls();
+
+    std::lock_guard<std::mutex> lock( m_writeMutex );
+    stats.sendCalls    = m_writeQueue.syscalls();
+    stats.queuedOutput = m_writeQueue.size();
+
+    return stats;
+}
+
+inline std::size_t EventWorker::queuedBytes()
+{
+    std::lock_guard<std::mutex> lock( m_writeMutex );
+    return m_writeQueue.size();
+}
+
+inline void EventWorker::finishRead()
+{
+    // A coroutine parked on a write or a sleep may still hold views into
+    // the buffer
+    if( m_continuation && ( m_awaiting == Awaiting::Write || m_awaiting == Awaiting::Sleep ) )
+        return;
+
+    m_readBuffer.consume( m_returnedBytes );
+    m_readBuffer.release();
+
+    m_returnedBytes = 0;
+}
+
+
+/////////////////////////// EventWorker::ReadAwaiter class //////////////////////////////
+inline bool EventWorker::ReadAwaiter::await_ready()
+{
+    // Whatever is already in the socket is picked up without suspending
+    return !m_eventWorker.read().empty() || m_eventWorker.m_peerClosed || m_eventWorker.isClosed();
+}
+
+inline void EventWorker::ReadAwaiter::await_suspend( std::coroutine_handle<> continuation )
+{
+    m_eventWorker.suspend( continuation, Awaiting::Read );
+}
+
+inline std::string_view EventWorker::ReadAwaiter::await_resume()
+{
+    return m_eventWorker.m_readBuffer.view();
+}
+
+
+/////////////////////////// EventWorker::FramesAwaiter class //////////////////////////////
+inline bool EventWorker::FramesAwaiter::await_ready()
+{
+    return !m_eventWorker.readFrames().empty() || m_eventWorker.m_peerClosed || m_eventWorker.isClosed();
+}
+
+inline void EventWorker::FramesAwaiter::await_suspend( std::coroutine_handle<> continuation )
+{
+    m_eventWorker.suspend( continuation, Awaiting::Frames );
+}
+
+inline const std::vector<std::string_view>& EventWorker::FramesAwaiter::await_resume()
+{
+    return m_eventWorker.m_frames;
+}
+
+
+/////////////////////////// EventWorker::WriteAwaiter class //////////////////////////////
+inline bool EventWorker::WriteAwaiter::await_ready()
+{
+    m_written = m_framed ? m_eventWorker.writeFrame( m_data ) : m_eventWorker.write( m_data );
+
+    return !m_written ||
+           m_eventWorker.queuedBytes() < m_eventWorker.m_eventLoop.m_eventListener.m_outputHighWatermark;
+}
+
+inline void EventWorker::WriteAwaiter::await_suspend( std::coroutine_handle<> continuation )
+{
+    m_eventWorker.suspend( continuation, Awaiting::Write );
+}
+
+inline bool EventWorker::WriteAwaiter::await_resume()
+{
+    return m_written && !m_eventWorker.isClosed();
+}
+
+
+/////////////////////////// EventWorker::SleepAwaiter class //////////////////////////////
+inline bool EventWorker::SleepAwaiter::await_ready()
+{
+    return m_delay.count() <= 0 || m_eventWorker.isClosed();
+}
+
+inline void EventWorker::SleepAwaiter::await_suspend( std::coroutine_handle<> continuation )
+{
+    // The timer fires into the dispatched job like any after() callback,
+    // which then resumes the coroutine
+    auto& eventWorker = m_eventWorker;
+
+    eventWorker.m_sleepExpired = false;
+    eventWorker.suspend( continuation, Awaiting::Sleep );
+    eventWorker.after( m_delay, [&eventWorker] { eventWorker.m_sleepExpired = true; } );
+}
+
+inline bool EventWorker::SleepAwaiter::await_resume()
+{
+    m_eventWorker.m_sleepExpired = false;
+    return !m_eventWorker.isClosed();
+}
+
+
+/////////////////////////// BufferPool class //////////////////////////////
+inline std::size_t BufferPool::sizeClass( std::size_t size )
+{
+    std::size_t index = 0;
+
+    while( ( minBufferSize << index ) < size )
+        index++;
+
+    return index;
+}
+
+inline char* BufferPool::acquire( std::size_t& size )
+{
+    auto index = sizeClass( size );
+    size       = minBufferSize << index;
+
+    if( index >= numSizeClasses )
+        return static_cast<char*>( ::operator new( size ) );
+
+    return static_cast<char*>( m_pools[index].allocate( size ) );
+}
+
+inline void BufferPool::release( char* data, std::size_t size )
+{
+    auto index = sizeClass( size );
+
+    if( index >= numSizeClasses )
+        ::operator delete( data );
+    else
+        m_pools[index].deallocate( data, size );
+}
+
+
+/////////////////////////// ReadBuffer class //////////////////////////////
+inline ReadBuffer::ReadBuffer( std::shared_ptr<BufferPool> pool )
+    : m_pool( std::move( pool ) )
+{
+}
+
+inline ReadBuffer::~ReadBuffer()
+{
+    if( m_data )
+        m_pool->release( m_data, m_capacity );
+}
+
+inline bool ReadBuffer::fill( int fileDescriptor )
+{
+    // Bytes that do not fit in the buffer land in a per-thread overflow
+    // area first, so one recvmsg can pull in up to 64 KiB more than the
+    // buffer currently holds and the buffer only grows when it must.
+    static thread_local char overflow[65536];
+
+    while( 1 )
+    {
+        reserve( 1 );
+
+        std::size_t space = m_capacity - m_tail;
+
+        iovec chunks[2];
+        chunks[0].iov_base = m_data + m_tail;
+        chunks[0].iov_len  = space;
+        chunks[1].iov_base = overflow;
+        chunks[1].iov_len  = sizeof( overflow );
+
+        msghdr message;
+        std::fill( reinterpret_cast<char*>( &message ),
+                   reinterpret_cast<char*>( &message ) + sizeof( message ),
+                   0 );
+
+        message.msg_iov    = chunks;
+        message.msg_iovlen = 2;
+
+        ssize_t numBytes = recvmsg( fileDescriptor, &message, MSG_DONTWAIT );
+        m_syscalls++;
+
+        if( numBytes == 0 )
+            return false;
+
+        if( numBytes < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        if( std::size_t( numBytes ) <= space )
+        {
+            m_tail += numBytes;
+        }
+        else
+        {
+            m_tail = m_capacity;
+            append( overflow, numBytes - space );
+        }
+
+        // A short read means the socket has been drained; the next edge
+        // (or the EPOLLONESHOT re-arm) reports anything that arrives later.
+        if( std::size_t( numBytes ) < space + sizeof( overflow ) )
+            return true;
+    }
+}
+
+inline void ReadBuffer::consume( std::size_t numBytes )
+{
+    m_head += std::min( numBytes, size() );
+
+    if( m_head == m_tail )
+        m_head = m_tail = 0;
+}
+
+inline void ReadBuffer::release()
+{
+    if( m_data && size() == 0 )
+    {
+        m_pool->release( m_data, m_capacity );
+
+        m_data     = nullptr;
+        m_capacity = 0;
+    }
+}
+
+inline void ReadBuffer::take( ReadBuffer& other )
+{
+    if( other.size() == 0 )
+        return;
+
+    // Usually we are empty and the storage just changes hands
+    if( size() == 0 )
+    {
+        std::swap( m_data, other.m_data );
+        std::swap( m_capacity, other.m_capacity );
+        std::swap( m_head, other.m_head );
+        std::swap( m_tail, other.m_tail );
+    }
+    else
+    {
+        append( other.m_data + other.m_head, other.size() );
+        other.m_head = other.m_tail = 0;
+    }
+
+    other.release();
+}
+
+inline std::size_t ReadBuffer::size() const
+{
+    return m_tail - m_head;
+}
+
+inline std::string_view ReadBuffer::view() const
+{
+    return std::string_view( m_data + m_head, size() );
+}
+
+inline uint64_t ReadBuffer::syscalls() const
+{
+    return m_syscalls;
+}
+
+inline void ReadBuffer::append( const char* data, std::size_t numBytes )
+{
+    reserve( numBytes );
+
+    std::copy( data, data + numBytes, m_data + m_tail );
+    m_tail += numBytes;
+}
+
+inline void ReadBuffer::reserve( std::size_t numBytes )
+{
+    if( m_capacity - m_tail >= numBytes )
+        return;
+
+    // Slide unread bytes to the front before asking for a bigger block
+    if( m_head > 0 && m_capacity - size() >= numBytes )
+    {
+        std::copy( m_data + m_head, m_data + m_tail, m_data );
+
+        m_tail -= m_head;
+        m_head  = 0;
+
+        return;
+    }
+
+    std::size_t capacity = std::max( m_capacity * 2, size() + numBytes );
+    char* data           = m_pool->acquire( capacity );
+
+    if( m_data )
+    {
+        std::copy( m_data + m_head, m_data + m_tail, data );
+        m_pool->release( m_data, m_capacity );
+    }
+
+    m_tail    -= m_head;
+    m_head     = 0;
+    m_data     = data;
+    m_capacity = capacity;
+}
+
+
+/////////////////////////// WriteQueue class //////////////////////////////
+inline WriteQueue::WriteQueue( std::shared_ptr<BufferPool> pool )
+    : m_pool( std::move( pool ) )
+{
+}
+
+inline WriteQueue::~WriteQueue()
+{
+    for( std::size_t i = m_firstChunk; i < m_chunks.size(); i++ )
+        m_pool->release( m_chunks[i].data, m_chunks[i].capacity );
+}
+
+inline void WriteQueue::append( std::string_view data )
+{
+    if( data.empty() )
+        return;
+
+    // Coalesce into the last chunk while it has room
+    if( m_firstChunk < m_chunks.size() )
+    {
+        auto& last = m_chunks.back();
+        auto numBytes = std::min( data.size(), last.capacity - last.tail );
+
+        std::copy( data.data(), data.data() + numBytes, last.data + last.tail );
+
+        last.tail += numBytes;
+        m_size    += numBytes;
+        data.remove_prefix( numBytes );
+    }
+
+    if( data.empty() )
+        return;
+
+    Chunk chunk;
+    chunk.capacity = std::max( chunkSize, data.size() );
+    chunk.data     = m_pool->acquire( chunk.capacity );
+    chunk.tail     = data.size();
+
+    std::copy( data.begin(), data.end(), chunk.data );
+
+    m_chunks.push_back( chunk );
+    m_size += data.size();
+}
+
+inline WriteQueue::FlushResult WriteQueue::flush( int fileDescriptor )
+{
+    static constexpr std::size_t maxChunksPerCall = 64;
+
+    while( m_size > 0 )
+    {
+        iovec chunks[maxChunksPerCall];
+        std::size_t numChunks = gather( chunks, maxChunksPerCall );
+
+        msghdr message;
+        std::fill( reinterpret_cast<char*>( &message ),
+                   reinterpret_cast<char*>( &message ) + sizeof( message ),
+                   0 );
+
+        message.msg_iov    = chunks;
+        message.msg_iovlen = numChunks;
+
+        ssize_t numBytes = sendmsg( fileDescriptor, &message, MSG_DONTWAIT | MSG_NOSIGNAL );
+        m_syscalls++;
+
+        if( numBytes < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
+                return FlushResult::Pending;
+
+            return FlushResult::Failed;
+        }
+
+        consume( numBytes );
+    }
+
+    return FlushResult::Drained;
+}
+
+inline std::size_t WriteQueue::gather( iovec* chunks, std::size_t maxChunks ) const
+{
+    std::size_t numChunks = 0;
+
+    for( std::size_t i = m_firstChunk; i < m_chunks.size() && numChunks < maxChunks; i++ )
+    {
+        chunks[numChunks].iov_base = m_chunks[i].data + m_chunks[i].head;
+        chunks[numChunks].iov_len  = m_chunks[i].tail - m_chunks[i].head;
+        numChunks++;
+    }
+
+    return numChunks;
+}
+
+inline void WriteQueue::consume( std::size_t numBytes )
+{
+    numBytes = std::min( numBytes, m_size );
+    m_size  -= numBytes;
+
+    // Release fully sent chunks, keep the last one for coalescing
+    while( numBytes > 0 )
+    {
+        auto& chunk = m_chunks[m_firstChunk];
+        auto sent   = std::min<std::size_t>( numBytes, chunk.tail - chunk.head );
+
+        chunk.head += sent;
+        numBytes   -= sent;
+
+        if( chunk.head == chunk.tail && m_firstChunk + 1 < m_chunks.size() )
+        {
+            m_pool->release( chunk.data, chunk.capacity );
+            m_firstChunk++;
+        }
+    }
+
+    if( m_size > 0 )
+        return;
+
+    // Drained: keep nothing but an empty vector around
+    for( std::size_t i = m_firstChunk; i < m_chunks.size(); i++ )
+        m_pool->release( m_chunks[i].data, m_chunks[i].capacity );
+
+    m_chunks.clear();
+    m_firstChunk = 0;
+}
+
+inline std::size_t WriteQueue::size() const
+{
+    return m_size;
+}
+
+inline uint64_t WriteQueue::syscalls() const
+{
+    return m_syscalls;
+}
+
+
+/////////////////////////// IoRing class //////////////////////////////
+inline IoRing::IoRing( unsigned entries, unsigned numBuffers, unsigned bufferSize )
+    : m_numBuffers( numBuffers )
+    , m_bufferSize( bufferSize )
+{
+    io_uring_params params;
+    std::fill( reinterpret_cast<char*>( &params ),
+               reinterpret_cast<char*>( &params ) + sizeof( params ),
+               0 );
+
+    // Completions are only reaped inside our own io_uring_enter, no task
+    // work interrupts the loop thread in between
+    params.flags      = IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER |
+                        IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    m_fileDescriptor = static_cast<int>( syscall( __NR_io_uring_setup, entries, &params ) );
+
+    if( m_fileDescriptor == -1 )
+        throw std::runtime_error( std::string( strerror( errno ) ) );
+
+    auto fail = [this] ( const std::string& message )
+    {
+        release();
+        throw std::runtime_error( message );
+    };
+
+    if( !( params.features & IORING_FEAT_SINGLE_MMAP ) )
+        fail( "io_uring without IORING_FEAT_SINGLE_MMAP" );
+
+    m_ringsSize = std::max( params.sq_off.array + params.sq_entries * sizeof( unsigned ),
+                            params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe ) );
+    m_rings     = mmap( nullptr, m_ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_fileDescriptor, IORING_OFF_SQ_RING );
+
+    if( m_rings == MAP_FAILED )
+    {
+        m_rings = nullptr;
+        fail( std::string( strerror( errno ) ) );
+    }
+
+    m_sqesSize = params.sq_entries * sizeof( io_uring_sqe );
+    void* sqes = mmap( nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       m_fileDescriptor, IORING_OFF_SQES );
+
+    if( sqes == MAP_FAILED )
+        fail( std::string( strerror( errno ) ) );
+
+    m_sqes = static_cast<io_uring_sqe*>( sqes );
+
+    auto* rings = static_cast<char*>( m_rings );
+
+    m_sqHead      = reinterpret_cast<unsigned*>( rings + params.sq_off.head );
+    m_sqTail      = reinterpret_cast<unsigned*>( rings + params.sq_off.tail );
+    m_sqArray     = reinterpret_cast<unsigned*>( rings + params.sq_off.array );
+    m_sqMask      = *reinterpret_cast<unsigned*>( rings + params.sq_off.ring_mask );
+    m_sqTailLocal = *m_sqTail;
+
+    m_cqHead = reinterpret_cast<unsigned*>( rings + params.cq_off.head );
+    m_cqTail = reinterpret_cast<unsigned*>( rings + params.cq_off.tail );
+    m_cqMask = *reinterpret_cast<unsigned*>( rings + params.cq_off.ring_mask );
+    m_cqes   = reinterpret_cast<io_uring_cqe*>( rings + params.cq_off.cqes );
+
+    // The buffer ring must be page aligned, the buffers behind it need not
+    m_bufferRingSize = std::size_t( numBuffers ) * sizeof( io_uring_buf );
+    void* bufferRing = mmap( nullptr, m_bufferRingSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if( bufferRing == MAP_FAILED )
+        fail( std::string( strerror( errno ) ) );
+
+    m_bufferRing = static_cast<io_uring_buf_ring*>( bufferRing );
+    m_buffers    = new char[std::size_t( numBuffers ) * bufferSize];
+
+    io_uring_buf_reg registration;
+    std::fill( reinterpret_cast<char*>( &registration ),
+               reinterpret_cast<char*>( &registration ) + sizeof( registration ),
+               0 );
+
+    registration.ring_addr    = reinterpret_cast<uint64_t>( m_bufferRing );
+    registration.ring_entries = numBuffers;
+    registration.bgid         = bufferGroup;
+
+    if( syscall( __NR_io_uring_register, m_fileDescriptor, IORING_REGISTER_PBUF_RING, &registration, 1 ) == -1 )
+        fail( std::string( strerror( errno ) ) );
+
+    for( unsigned i = 0; i < numBuffers; i++ )
+        recycle( i );
+}
+
+inline IoRing::~IoRing()
+{
+    release();
+}
+
+inline void IoRing::release()
+{
+    if( m_fileDescriptor != -1 )
+        ::close( m_fileDescriptor );
+
+    if( m_sqes )
+        munmap( m_sqes, m_sqesSize );
+
+    if( m_rings )
+        munmap( m_rings, m_ringsSize );
+
+    if( m_bufferRing )
+        munmap( m_bufferRing, m_bufferRingSize );
+
+    delete[] m_buffers;
+
+    m_fileDescriptor = -1;
+    m_sqes           = nullptr;
+    m_rings          = nullptr;
+    m_bufferRing     = nullptr;
+    m_buffers        = nullptr;
+}
+
+inline void IoRing::enable()
+{
+    if( syscall( __NR_io_uring_register, m_fileDescriptor, IORING_REGISTER_ENABLE_RINGS, nullptr, 0 ) == -1 )
+        throw std::runtime_error( std::string( strerror( errno ) ) );
+}
+
+inline io_uring_sqe* IoRing::prepare()
+{
+    if( m_sqTailLocal - __atomic_load_n( m_sqHead, __ATOMIC_ACQUIRE ) > m_sqMask )
+        enter( m_unsubmitted, 0, 0 );
+
+    unsigned index = m_sqTailLocal & m_sqMask;
+    auto* entry    = &m_sqes[index];
+
+    std::fill( reinterpret_cast<char*>( entry ),
+               reinterpret_cast<char*>( entry ) + sizeof( *entry ),
+               0 );
+
+    m_sqArray[index] = index;
+    m_sqTailLocal++;
+    m_unsubmitted++;
+
+    // Nothing polls the queue, the kernel looks at it during enter() only
+    __atomic_store_n( m_sqTail, m_sqTailLocal, __ATOMIC_RELEASE );
+
+    return entry;
+}
+
+inline int IoRing::submitAndWait( int timeout )
+{
+    if( timeout < 0 )
+        return enter( m_unsubmitted, 1, IORING_ENTER_GETEVENTS );
+
+    __kernel_timespec timespec;
+    timespec.tv_sec  = timeout / 1000;
+    timespec.tv_nsec = ( timeout % 1000 ) * 1000000LL;
+
+    io_uring_getevents_arg argument;
+
+    std::fill( reinterpret_cast<char*>( &argument ),
+               reinterpret_cast<char*>( &argument ) + sizeof( argument ),
+               0 );
+
+    argument.ts = reinterpret_cast<uint64_t>( &timespec );
+
+    // Fails with ETIME when nothing completed in time
+    return enter( m_unsubmitted, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &argument, sizeof( argument ) );
+}
+
+inline int IoRing::enter( unsigned numSubmissions,
+                          unsigned minCompletions,
+                          unsigned flags,
+                          const void* argument,
+                          std::size_t argumentSize )
+{
+    int result = static_cast<int>( syscall( __NR_io_uring_enter, m_fileDescriptor,
+                                            numSubmissions, minCompletions, flags, argument, argumentSize ) );
+
+    if( result > 0 )
+        m_unsubmitted -= std::min( unsigned( result ), m_unsubmitted );
+
+    return result;
+}
+
+template <class F>
+inline void IoRing::forEachCompletion( F&& f )
+{
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n( m_cqTail, __ATOMIC_ACQUIRE );
+
+    for( ; head != tail; head++ )
+        f( m_cqes[head & m_cqMask] );
+
+    __atomic_store_n( m_cqHead, head, __ATOMIC_RELEASE );
+}
+
+inline char* IoRing::buffer( unsigned bufferId )
+{
+    return m_buffers + std::size_t( bufferId ) * m_bufferSize;
+}
+
+inline void IoRing::recycle( unsigned bufferId )
+{
+    // Indexed by hand: compiled as C++ the header's flexible array member
+    // does not start at offset 0 as it does for the kernel
+    auto& entry = reinterpret_cast<io_uring_buf*>( m_bufferRing )[m_bufferTail & ( m_numBuffers - 1 )];
+
+    entry.addr = reinterpret_cast<uint64_t>( buffer( bufferId ) );
+    entry.len  = m_bufferSize;
+    entry.bid  = static_cast<uint16_t>( bufferId );
+
+    m_bufferTail++;
+    __atomic_store_n( &m_bufferRing->tail, m_bufferTail, __ATOMIC_RELEASE );
+}
+
+
+/////////////////////////// TimerWheel class //////////////////////////////
+inline TimerWheel::~TimerWheel()
+{
+    for( auto timer : m_slots )
+    {
+        while( timer )
+        {
+            auto next = timer->next;
+
+            timer->~Timer();
+            m_pool.deallocate( timer, sizeof( Timer ) );
+
+            timer = next;
+        }
+    }
+}
+
+inline uint64_t TimerWheel::now() const
+{
+    return uint64_t( std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - m_start ).count() );
+}
+
+inline uint64_t TimerWheel::deadline( std::chrono::milliseconds delay ) const
+{
+    // now() rounds down, one more tick makes sure the delay has passed
+    return now() + uint64_t( std::max<int64_t>( delay.count(), 0 ) ) + 1;
+}
+
+inline TimerWheel::Timer* TimerWheel::schedule( uint64_t deadline, std::function<void ( Timer* timer )> callback )
+{
+    auto timer = new ( m_pool.allocate( sizeof( Timer ) ) ) Timer;
+
+    timer->deadline = deadline;
+    timer->callback = std::move( callback );
+
+    link( timer );
+    m_size++;
+
+    return timer;
+}
+
+inline void TimerWheel::cancel( Timer* timer )
+{
+    // The firing timer is freed by advance() once its callback returns
+    if( !timer || timer == m_firing )
+        return;
+
+    unlink( timer );
+    m_size--;
+
+    timer->~Timer();
+    m_pool.deallocate( timer, sizeof( Timer ) );
+}
+
+inline void TimerWheel::advance( uint64_t now )
+{
+    // Jumps from one slot that needs attention to the next, the ticks in
+    // between have nothing to do
+    uint64_t tick = 0;
+
+    while( nextTick( tick ) && tick <= now )
+    {
+        m_current = tick;
+
+        // Higher levels first, their timers may drop into the slots below
+        for( unsigned level = numLevels - 1; level > 0; level-- )
+        {
+            unsigned shift = level * slotBits;
+
+            if( tick & ( ( uint64_t( 1 ) << shift ) - 1 ) )
+                continue;
+
+            unsigned index = unsigned( tick >> shift ) & ( numSlots - 1 );
+            auto timer     = m_slots[level * numSlots + index];
+
+            m_slots[level * numSlots + index] = nullptr;
+            m_occupied[level] &= ~( uint64_t( 1 ) << index );
+
+            while( timer )
+            {
+                auto next = timer->next;
+                link( timer );
+                timer = next;
+            }
+        }
+
+        // Everything in the slot of this tick is due. It moves to the
+        // expiring list so that callbacks can cancel any of it.
+        unsigned index = unsigned( tick ) & ( numSlots - 1 );
+
+        for( auto timer = m_slots[index]; timer; timer = timer->next )
+            timer->slot = expiringSlot;
+
+        m_slots[expiringSlot] = m_slots[index];
+        m_slots[index]        = nullptr;
+        m_occupied[0] &= ~( uint64_t( 1 ) << index );
+
+        m_current = tick + 1;
+
+        while( auto timer = m_slots[expiringSlot] )
+        {
+            unlink( timer );
+            m_size--;
+
+            m_firing = timer;
+            timer->callback( timer );
+            m_firing = nullptr;
+
+            timer->~Timer();
+            m_pool.deallocate( timer, sizeof( Timer ) );
+        }
+    }
+
+    m_current = std::max( m_current, now + 1 );
+}
+
+inline int TimerWheel::timeout( uint64_t now ) const
+{
+    uint64_t tick = 0;
+
+    if( !nextTick( tick ) )
+        return -1;
+
+    return tick <= now ? 0 : int( std::min<uint64_t>( tick - now, INT_MAX ) );
+}
+
+inline std::size_t TimerWheel::size() const
+{
+    return m_size;
+}
+
+inline void TimerWheel::link( Timer* timer )
+{
+    // Overdue timers fire on the next tick processed
+    uint64_t deadline = std::max( timer->deadline, m_current );
+    uint64_t diff     = deadline ^ m_current;
+    unsigned level    = diff ? unsigned( std::bit_width( diff ) - 1 ) / slotBits : 0;
+    unsigned index    = 0;
+
+    if( level < numLevels )
+    {
+        index = unsigned( deadline >> ( level * slotBits ) ) & ( numSlots - 1 );
+    }
+    else
+    {
+        // The deadline lies in a later turn of the top level: wait in the
+        // top slot it falls into, or in the last one to come round when it
+        // is more than a turn away, and get placed again from there
+        level = numLevels - 1;
+
+        uint64_t current = m_current >> ( level * slotBits );
+        uint64_t ahead   = ( deadline >> ( level * slotBits ) ) - current;
+
+        index = unsigned( current + std::min<uint64_t>( ahead, numSlots - 1 ) ) & ( numSlots - 1 );
+    }
+
+    timer->slot = level * numSlots + index;
+    timer->prev = nullptr;
+    timer->next = m_slots[timer->slot];
+
+    if( timer->next )
+        timer->next->prev = timer;
+
+    m_slots[timer->slot] = timer;
+    m_occupied[level] |= uint64_t( 1 ) << index;
+}
+
+inline void TimerWheel::unlink( Timer* timer )
+{
+    if( timer->prev )
+        timer->prev->next = timer->next;
+    else
+        m_slots[timer->slot] = timer->next;
+
+    if( timer->next )
+        timer->next->prev = timer->prev;
+
+    if( timer->slot != expiringSlot && !m_slots[timer->slot] )
+        m_occupied[timer->slot / numSlots] &= ~( uint64_t( 1 ) << ( timer->slot % numSlots ) );
+
+    timer->prev = nullptr;
+    timer->next = nullptr;
+}
+
+inline bool TimerWheel::nextTick( uint64_t& tick ) const
+{
+    // The first occupied slot at or after the current one, per level.
+    // Level 0 slots are due at their tick, the others cascade at the start
+    // of their range.
+    bool found = false;
+
+    for( unsigned level = 0; level < numLevels; level++ )
+    {
+        if( !m_occupied[level] )
+            continue;
+
+        unsigned shift    = level * slotBits;
+        unsigned current  = unsigned( m_current >> shift ) & ( numSlots - 1 );
+        unsigned ahead    = unsigned( std::countr_zero( std::rotr( m_occupied[level], int( current ) ) ) );
+        uint64_t slotTick = ( ( m_current >> shift ) + ahead ) << shift;
+
+        if( !found || slotTick < tick )
+            tick = slotTick;
+
+        found = true;
+    }
+
+    return found;
+}
+
+
+/////////////////////////// LatencyHistogram class //////////////////////////////
+inline unsigned LatencyHistogram::bucketOf( uint64_t value )
+{
+    if( value < numSubBuckets )
+        return unsigned( value );
+
+    unsigned exponent = 63 - __builtin_clzll( value );
+    unsigned sub      = unsigned( value >> ( exponent - subBucketBits ) ) & ( numSubBuckets - 1 );
+
+    return ( exponent - subBucketBits + 1 ) * numSubBuckets + sub;
+}
+
+inline uint64_t LatencyHistogram::valueOf( unsigned bucket )
+{
+    // Midpoint of the bucket's range
+    unsigned group = bucket / numSubBuckets;
+    uint64_t sub   = bucket % numSubBuckets;
+
+    if( group == 0 )
+        return sub;
+
+    unsigned shift = group - 1;
+
+    return ( ( numSubBuckets + sub ) << shift ) + ( ( uint64_t( 1 ) << shift ) >> 1 );
+}
+
+inline void LatencyHistogram::record( uint64_t value )
+{
+    m_buckets[bucketOf( value )].fetch_add( 1, std::memory_order_relaxed );
+    m_count.fetch_add( 1, std::memory_order_relaxed );
+    m_sum.fetch_add( value, std::memory_order_relaxed );
+
+    uint64_t max = m_max.load( std::memory_order_relaxed );
+
+    while( value > max && !m_max.compare_exchange_weak( max, value, std::memory_order_relaxed ) )
+        ;
+}
+
+inline void LatencyHistogram::merge( const LatencyHistogram& other )
+{
+    for( unsigned i = 0; i < numBuckets; i++ )
+        m_buckets[i].fetch_add( other.m_buckets[i].load( std::memory_order_relaxed ), std::memory_order_relaxed );
+
+    m_count.fetch_add( other.m_count.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+    m_sum.fetch_add( other.m_sum.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+
+    uint64_t max = other.m_max.load( std::memory_order_relaxed );
+
+    if( max > m_max.load( std::memory_order_relaxed ) )
+        m_max.store( max, std::memory_order_relaxed );
+}
+
+inline uint64_t LatencyHistogram::count() const
+{
+    return m_count.load( std::memory_order_relaxed );
+}
+
+inline uint64_t LatencyHistogram::max() const
+{
+    return m_max.load( std::memory_order_relaxed );
+}
+
+inline double LatencyHistogram::mean() const
+{
+    auto numValues = count();
+    return numValues ? double( m_sum.load( std::memory_order_relaxed ) ) / numValues : 0.0;
+}
+
+inline uint64_t LatencyHistogram::percentile( double fraction ) const
+{
+    auto numValues = count();
+
+    if( numValues == 0 )
+        return 0;
+
+    auto rank   = uint64_t( fraction * ( numValues - 1 ) ) + 1;
+    uint64_t seen = 0;
+
+    for( unsigned i = 0; i < numBuckets; i++ )
+    {
+        seen += m_buckets[i].load( std::memory_order_relaxed );
+
+        if( seen >= rank )
+            return std::min( valueOf( i ), max() );
+    }
+
+    return max();
+}
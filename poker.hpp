@@ -0,0 +1,1807 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <array>
+#include <random>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <bit>
+#include <numeric>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <thread>
+#include <cmath>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+class Card
+{
+public:
+    enum class SUIT { HEART = 1, DIAMOND, CLUB, SPADE };
+    enum class RANK { A = 1, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE, TEN, J, Q, K };
+
+    // Both throw std::invalid_argument unless the card is one of the 52, so every
+    // Card holds a code Hand::bit and Deck can index with
+    constexpr Card() = default;
+    constexpr Card(SUIT suit, RANK rank);
+    static constexpr Card fromCode(uint8_t code);
+
+    constexpr SUIT suit() const { return SUIT((m_code & 3) + 1); }
+    constexpr RANK rank() const { return RANK((m_code >> 2) + 1); }
+    constexpr uint8_t code() const { return m_code; }          // (rank - 1) * 4 + suit - 1, 0..51
+
+    // operator overloads
+    friend bool operator < (const Card& lhs, const Card& rhs);  // lhs.rank < rhs.rank
+    friend bool operator > (const Card& lhs, const Card& rhs);  // lhs.rank > rhs.rank
+    friend bool operator == (const Card& lhs, const Card& rhs); // lhs.suit == rhs.suit
+    friend bool operator != (const Card& lhs, const Card& rhs); // lhs.suit != rhs.suit
+    friend std::ostream& operator << (std::ostream& os, const Card& card);
+
+private:
+    uint8_t m_code = 0;
+};
+
+
+// xoshiro256** seeded through splitmix64: a few cycles per draw and no shared state,
+// so every thread or work chunk owns one and nothing locks.
+class Random
+{
+public:
+    explicit Random(uint64_t seed);
+
+    uint64_t next();
+    uint32_t below(uint32_t bound);     // uniform in [0, bound), bias under bound / 2^32
+    static uint64_t splitmix(uint64_t& state);
+
+private:
+    std::array<uint64_t, 4> m_state;
+};
+
+
+using CardList = std::initializer_list<Card>;
+using CardArray_5 = const std::array<Card, 5>;
+
+// Set of cards packed into one 64-bit word: a 16-bit lane per suit, bit (rank - 1)
+// inside the lane, so A is bit 0 and K is bit 12. Hand checks are a few shifts,
+// ANDs and popcounts instead of building strings.
+class Hand
+{
+public:
+    static constexpr unsigned suitBits = 16;
+    static constexpr uint64_t suitMask = 0x1FFF;    // 13 ranks of one suit
+
+    constexpr Hand() = default;
+    explicit constexpr Hand(uint64_t mask) : m_mask(mask) { }
+    constexpr Hand(CardList cards) { for(auto& card: cards) *this += card; }
+    template<size_t N>
+    constexpr Hand(const std::array<Card, N>& cards) { for(auto& card: cards) *this += card; }
+
+    constexpr Hand& operator += (const Card& card) { m_mask |= bit(card); return *this; }
+    constexpr Hand& operator -= (const Card& card) { m_mask &= ~bit(card); return *this; }
+    constexpr bool contains(const Card& card) const { return m_mask & bit(card); }
+
+    constexpr uint64_t mask() const { return m_mask; }
+    constexpr unsigned suit(Card::SUIT suit) const;     // rank bits held in one suit
+    constexpr unsigned ranks() const;                   // rank bits held in any suit
+    constexpr unsigned size() const { return std::popcount(m_mask); }
+    constexpr unsigned suitCount() const;               // number of suits present
+
+    constexpr bool isFlush() const;     // five or more cards of one suit
+    constexpr bool isStraight() const;  // five consecutive ranks, A plays low or high
+
+    static constexpr uint64_t bit(const Card& card);
+
+private:
+    uint64_t m_mask = 0;
+};
+// Up to 52 distinct cards held in place, no allocation, two cache lines. The top of
+// the deck is the end of the array, so dealing pops it, and m_slots finds any card's
+// index so removing one is a swap with the top.
+class Deck
+{
+public:
+    static constexpr unsigned capacity = 52;
+
+    constexpr Deck() = default;
+    constexpr Deck(CardList cards) { for(auto& card: cards) add(card); }
+    static constexpr Deck standard();                                   // 52 cards, A..K of each suit
+
+    constexpr unsigned totalCards() const { return m_size; }           // total number of cards in the deck
+    const Card& at(unsigned i) const;                                   // access card by given index
+    constexpr bool contains(const Card& card) const;
+    constexpr void add(const Card& card);                               // put a card on top
+    Card deal();                                                        // take the top card
+    bool remove(const Card& card);                                      // take a card out from anywhere
+    void shuffle();                                                     // randomize all the cards in a deck
+    void shuffle(Random& random, unsigned count);                       // randomize only the top count cards
+
+    static bool isFlush(CardList cards);                // if all cards have the same suit
+    static bool isStraight(CardArray_5  &cards);  // if all 5 cards have consecutive ranks
+
+private:
+    void swap(unsigned i, unsigned j);
+
+    std::array<Card, capacity> m_cards{};
+    std::array<uint8_t, capacity> m_slots{};    // card code -> index in m_cards while held
+    uint8_t m_size = 0;
+};
+
+
+// Hands stored structure-of-arrays: one 13-bit rank lane per suit, so a vector
+// load picks up the same suit of 8 (SSE) or 16 (AVX2) consecutive hands.
+class HandBatch
+{
+public:
+    HandBatch() = default;
+    HandBatch(size_t capacity) { for(auto& suit: m_suits) suit.reserve(capacity); }
+
+    void push(const Hand& hand);
+    void clear() { for(auto& suit: m_suits) suit.clear(); }
+    size_t size() const { return m_suits[0].size(); }
+    Hand at(size_t i) const;
+    const uint16_t* suit(unsigned suit) const { return m_suits[suit].data(); }     // lane of Card::SUIT(suit + 1)
+
+private:
+    std::array<std::vector<uint16_t>, 4> m_suits;
+};
+
+
+// Ranks 5..7 cards as a comparable integer: category << 20, then the five cards
+// that play as 4-bit values (2..14, A high), most significant first. Higher wins,
+// equal splits. Flushes are one constexpr lookup on the suit lane; everything else
+// sums a base-5 rank-count key from the lanes and looks it up in a perfect hash.
+class HandEvaluator
+{
+public:
+    enum class CATEGORY { HIGH_CARD, PAIR, TWO_PAIR, TRIPS, STRAIGHT, FLUSH, FULL_HOUSE, QUADS, STRAIGHT_FLUSH };
+
+    static uint32_t evaluate(const Hand& hand);     // best five of the 5..7 cards in the hand
+    static CATEGORY category(uint32_t strength) { return CATEGORY(strength >> 20); }
+
+    // Batch versions run the widest kernel the CPU supports, picked once at first use.
+    // setKernel forces another one the CPU supports, so each can be tested and timed
+    // on one host; a batch already running finishes on the kernel it started with.
+    enum : uint8_t { FLUSH = 1, STRAIGHT = 2 };
+    static void classify(const HandBatch& batch, uint8_t* flags);       // FLUSH | STRAIGHT per hand
+    static void evaluate(const HandBatch& batch, uint32_t* strengths);
+    static const char* kernel();                                        // "avx2", "sse4.1" or "scalar"
+    static std::vector<std::string> kernels();                          // supported here, widest first
+    static bool setKernel(const std::string& name);                     // false if not supported here
+
+private:
+    using Counts = std::array<uint8_t, 15>;         // cards held per value, index 2..14
+
+    HandEvaluator();
+    HandEvaluator(const HandEvaluator&) = delete;
+    HandEvaluator& operator = (const HandEvaluator&) = delete;
+
+    static const HandEvaluator& instance();
+    static uint32_t bucket(uint32_t key);
+    uint32_t slot(uint32_t key, uint32_t seed) const;
+    uint32_t lookup(uint32_t key) const;
+
+    static constexpr unsigned value(unsigned bit) { return bit ? bit + 1 : 14; }    // lane bit -> 2..14
+    static constexpr unsigned straight(unsigned ranks);     // top value of the best straight, 0 if none
+    static constexpr uint32_t strength(CATEGORY category, std::initializer_list<unsigned> values);
+    static constexpr uint32_t rankStrength(const Counts& counts);
+    static constexpr std::array<uint32_t, 8192> makeFlushTable();
+    static constexpr std::array<uint32_t, 8192> makeKeyTable();
+
+    static const std::array<uint32_t, 8192> m_flushTable;  // suit lane -> flush strength, 0 under five cards
+    static const std::array<uint32_t, 8192> m_keyTable;    // suit lane -> sum of 5^bit
+
+    struct Kernels
+    {
+        void (*classify)(const HandBatch& batch, uint8_t* flags, size_t begin, size_t end);
+        void (*evaluate)(const HandBatch& batch, uint32_t* strengths, size_t begin, size_t end);
+        const char* name;
+    };
+    static const std::vector<Kernels>& supported();
+    static const Kernels& selected();
+    static std::atomic<const Kernels*> m_forced;           // by setKernel, null for the widest
+    static void classifyScalar(const HandBatch& batch, uint8_t* flags, size_t begin, size_t end);
+    static void evaluateScalar(const HandBatch& batch, uint32_t* strengths, size_t begin, size_t end);
+#if defined(__x86_64__) || defined(__i386__)
+    static void classifySse41(const HandBatch& batch, uint8_t* flags, size_t begin, size_t end);
+    static void classifyAvx2(const HandBatch& batch, uint8_t* flags, size_t begin, size_t end);
+    static void evaluateAvx2(const HandBatch& batch, uint32_t* strengths, size_t begin, size_t end);
+#endif
+
+    static constexpr unsigned bucketBits = 14;
+    std::vector<uint32_t> m_seeds;          // displacement per bucket
+    std::vector<uint32_t> m_strengths;      // indexed by the displaced slot
+};
+
+
+// Chunk indices split evenly across threads. Each thread takes from the front of its
+// own range and, once that is empty, steals the back half of a busy neighbour's.
+class ChunkQueue
+{
+public:
+    ChunkQueue(uint64_t chunks, unsigned threads);
+
+    bool next(unsigned thread, uint64_t& chunk);
+
+    // runs work(thread, chunk) for every chunk on the given number of threads
+    static void run(uint64_t chunks, unsigned threads, const std::function<void(unsigned, uint64_t)>& work);
+
+private:
+    bool take(unsigned thread, uint64_t& chunk);
+    bool steal(unsigned thread);
+
+    std::vector<std::atomic<uint64_t>> m_ranges;    // begin << 32 | end still owned by each thread
+};
+
+
+// k-card subsets of a card list in colex order, starting from any index: the
+// constructor unranks it through the combinatorial number system, i.e. positions
+// c[k-1] > ... > c[0] with sum binomial(c[i], i + 1) == first. next() bumps the
+// lowest position that has room, resets the ones below it, and swaps only those
+// cards in and out of the union mask.
+class Combinations
+{
+public:
+    Combinations(const std::vector<uint64_t>& cards, unsigned k, uint64_t first = 0);
+
+    uint64_t mask() const { return m_mask; }
+    bool next();                // false after the last subset
+
+    static constexpr uint64_t binomial(unsigned n, unsigned k);
+
+private:
+    const std::vector<uint64_t>& m_cards;
+    unsigned m_k;
+    std::array<unsigned, 5> m_positions = {};
+    uint64_t m_mask = 0;
+};
+
+
+// Equity for known hole cards and a partial board, either sampled or exact.
+// run() deals Monte Carlo trials in fixed chunks, each seeded from (seed, chunk
+// index), so a given seed gives the same counts on any thread count. enumerate()
+// walks every remaining board with Combinations, one chunk of indices at a time.
+class EquitySimulator
+{
+public:
+    static constexpr unsigned maxPlayers = 10;
+    static constexpr uint64_t chunkTrials = 4096;
+
+    struct Player
+    {
+        uint64_t wins = 0, ties = 0, losses = 0;
+        double equity = 0;      // wins plus split shares, per trial
+        double stdError = 0;    // standard error of equity
+    };
+
+    EquitySimulator(const std::vector<Hand>& holes, const Hand& board = Hand());
+
+    std::vector<Player> run(uint64_t trials, uint64_t seed = 0, unsigned threads = 0) const;
+    std::vector<Player> enumerate(unsigned threads = 0) const;     // exact, stdError is 0
+    uint64_t boards() const;                                        // boards enumerate() visits
+
+private:
+    struct Tally
+    {
+        std::array<uint64_t, maxPlayers> wins{}, ties{}, losses{}, shares{}, squares{};
+    };
+    static unsigned threadCount(unsigned threads, uint64_t chunks);
+    void simulate(uint64_t chunk, uint64_t trials, uint64_t seed, Tally& tally) const;
+    void walk(uint64_t first, uint64_t count, Tally& tally) const;
+    void showdown(uint64_t board, Tally& tally) const;
+    std::vector<Player> total(const std::vector<Tally>& tallies, uint64_t trials, bool sampled) const;
+
+    static constexpr uint64_t shareUnit = 2520;     // divisible by every split count up to 10
+
+    std::vector<Hand> m_holes;
+    Hand m_board;
+    Deck m_deck;                        // cards not dealt yet
+    std::vector<uint64_t> m_stub;       // the same cards, one bit each, in deck order
+};
+
+
+// Suit isomorphism for cards dealt in rounds, after Waugh's hand indexer: rounds
+// {2, 3} are hole cards and flop. Two hands that differ only by renaming suits, each
+// card staying in its round, share one canonical form and one index, and the
+// indices of a round layout fill [0, size()) without gaps (169 for {2}, 1,286,792
+// for {2, 3}). A suit is described by how many cards it has per round and, given
+// that, a mixed-radix index of its rank sets; a hand is the multiset of its four
+// suits, indexed per group of suits with equal sizes.
+class HandIndexer
+{
+public:
+    static constexpr unsigned maxRounds = 4;
+
+    explicit HandIndexer(const std::vector<unsigned>& rounds);     // cards per round
+
+    uint64_t size() const { return m_size; }
+    uint64_t index(const std::vector<Hand>& hand) const;           // one Hand per round
+    std::vector<Hand> canonical(const std::vector<Hand>& hand) const;
+    std::vector<Hand> unindex(uint64_t index) const;                // canonical hand of an index
+    unsigned multiplicity(const std::vector<Hand>& hand) const;     // suit relabelings of the hand, 1..24
+
+private:
+    using Sizes = std::array<uint8_t, maxRounds>;       // cards of one suit per round
+
+    struct Suit
+    {
+        Sizes sizes{};
+        uint64_t index = 0;
+        std::array<unsigned, maxRounds> sets{};         // rank bits per round
+        bool operator > (const Suit& other) const { return std::tie(sizes, index) > std::tie(other.sizes, other.index); }
+    };
+    struct Config
+    {
+        std::array<Sizes, 4> sizes;     // descending, the canonical suit order
+        uint64_t offset = 0;
+    };
+
+    std::array<Suit, 4> split(const std::vector<Hand>& hand) const;     // suits in canonical order
+    std::vector<Hand> join(const std::array<Suit, 4>& suits) const;     // suit s into lane s
+    uint64_t suitSize(const Sizes& sizes) const;
+    Suit suitAt(const Sizes& sizes, uint64_t index) const;
+    template <class F> uint64_t forGroups(const std::array<Sizes, 4>& sizes, F&& f) const;
+    static uint64_t key(const std::array<Sizes, 4>& sizes);
+
+    std::vector<unsigned> m_rounds;
+    std::vector<Config> m_configs;      // sorted by key
+    std::vector<uint64_t> m_keys;
+    uint64_t m_size = 0;
+};
+
+
+// Combos of hole cards in the usual notation, comma separated: pairs "QQ", "QQ+",
+// "QQ-99"; suited or offsuit "AKs", "AKo", both "AK"; kicker runs "ATs+" (up to
+// AKs) and "A5s-A2s"; exact cards "AhKh". Combos are kept sorted and unique.
+class Range
+{
+public:
+    Range() = default;
+    explicit Range(const std::string& notation);
+
+    void add(const Hand& combo);
+    const std::vector<Hand>& combos() const { return m_combos; }
+    size_t size() const { return m_combos.size(); }
+    uint64_t id() const;            // hash of the combo set, same set same id
+    bool isSymmetric() const;       // unchanged by every suit permutation
+
+    static uint64_t permute(uint64_t mask, const std::array<unsigned, 4>& suits);   // lane s moves to suits[s]
+
+private:
+    void addToken(const std::string& token);
+    void addClass(unsigned high, unsigned low, char kind);      // kind 's', 'o' or 0 for both
+    bool contains(uint64_t mask) const;
+
+    std::vector<Hand> m_combos;
+};
+
+
+// Mutex-per-shard hash map: concurrent readers share a shard, writers lock one
+// shard only, so lookups from many threads rarely contend.
+template <class Key, class Value, class Hash = std::hash<Key>>
+class ShardedMap
+{
+public:
+    bool find(const Key& key, Value& value) const
+    {
+        auto& shard = shardOf(key);
+        std::shared_lock lock(shard.mutex);
+        auto found = shard.map.find(key);
+        if(found == shard.map.end()) return false;
+        value = found->second;
+        return true;
+    }
+
+    void insert(const Key& key, const Value& value)
+    {
+        auto& shard = shardOf(key);
+        std::unique_lock lock(shard.mutex);
+        shard.map.emplace(key, value);
+    }
+
+    size_t size() const
+    {
+        size_t total = 0;
+        for(auto& shard: m_shards) {
+            std::shared_lock lock(shard.mutex);
+            total += shard.map.size();
+        }
+        return total;
+    }
+
+private:
+    struct Shard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<Key, Value, Hash> map;
+    };
+    Shard& shardOf(const Key& key) const { return m_shards[Hash()(key) % m_shards.size()]; }
+
+    mutable std::array<Shard, 16> m_shards;
+};
+
+
+// Equity of one range against another on a board. Every runout is ranked once:
+// the union of both ranges goes through the batch evaluator, and all combo pairs
+// then compare cached strengths. Runouts are enumerated when there are at most
+// exactBoards of them, otherwise that many are sampled from a fixed seed. Results
+// are memoized per (board, ranges). For suit-symmetric ranges the board is first
+// made canonical, so isomorphic boards share one entry, and exact runouts that a
+// suit permutation fixing the board maps onto each other are ranked once, weighted.
+class RangeEquity
+{
+public:
+    static constexpr uint64_t exactBoards = 50000;
+    static constexpr uint64_t chunkBoards = 16;
+
+    struct Result
+    {
+        double equity = 0;          // first range's share, split pots count half
+        uint64_t matchups = 0;      // combo pairs times runouts compared
+        uint64_t boards = 0;        // runouts ranked
+        bool sampled = false;
+    };
+
+    RangeEquity(unsigned threads = 0);
+
+    Result compare(const Range& hero, const Range& villain, const Hand& board = Hand());
+    size_t cached() const { return m_cache.size(); }
+
+private:
+    struct Key
+    {
+        uint64_t board, hero, villain;
+        bool operator == (const Key& other) const = default;
+    };
+    struct KeyHash
+    {
+        size_t operator () (const Key& key) const;
+    };
+    struct Tally
+    {
+        uint64_t halves = 0, matchups = 0;      // two per win, one per split
+    };
+    Result solve(const Range& hero, const Range& villain, const Hand& board, bool symmetric) const;
+
+    unsigned m_threads;
+    std::vector<HandIndexer> m_boards;      // rounds {n} by board size n
+    std::vector<HandIndexer> m_runouts;     // rounds {n, 5 - n}
+    ShardedMap<Key, Result, KeyHash> m_cache;
+};
+
+
+
+/////////////////////////// Card class //////////////////////////////
+constexpr Card::Card(SUIT suit, RANK rank)
+{
+    if(unsigned(suit) - 1 >= 4 || unsigned(rank) - 1 >= 13) {
+        throw std::invalid_argument("invalid card suit " + std::to_string(unsigned(suit)) + " rank " + std::to_string(unsigned(rank)));
+    }
+    m_code = uint8_t((unsigned(rank) - 1) * 4 + unsigned(suit) - 1);
+}
+
+constexpr Card Card::fromCode(uint8_t code)
+{
+    if(code >= 52) {
+        throw std::invalid_argument("invalid card code " + std::to_string(code));
+    }
+    Card card;
+    card.m_code = code;
+    return card;
+}
+
+inline bool operator < (const Card& lhs, const Card& rhs)
+{
+    return lhs.rank() < rhs.rank();
+}
+
+inline bool operator > (const Card& lhs, const Card& rhs)
+{
+    return rhs < lhs;
+}
+
+inline bool operator == (const Card& lhs, const Card& rhs)
+{
+    return lhs.suit() == rhs.suit();
+}
+
+inline bool operator != (const Card& lhs, const Card& rhs)
+{
+    return !(lhs == rhs);
+}
+
+inline std::ostream& operator << (std::ostream& os, const Card& card)
+{
+    return os << "suit: " << unsigned(card.suit()) << ", rank: " << unsigned(card.rank());
+}
+
+static_assert(sizeof(Card) == 1 && std::is_trivially_copyable_v<Card>);
+
+
+
+/////////////////////////// Random class //////////////////////////////
+inline Random::Random(uint64_t seed)
+{
+    for(auto& word: m_state) {
+        word = splitmix(seed);
+    }
+}
+
+inline uint64_t Random::splitmix(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t Random::next()
+{
+    auto result = std::rotl(m_state[1] * 5, 7) * 9;
+    auto t = m_state[1] << 17;
+    m_state[2] ^= m_state[0];
+    m_state[3] ^= m_state[1];
+    m_state[1] ^= m_state[2];
+    m_state[0] ^= m_state[3];
+    m_state[2] ^= t;
+    m_state[3] = std::rotl(m_state[3], 45);
+    return result;
+}
+
+inline uint32_t Random::below(uint32_t bound)
+{
+    return uint32_t(((next() >> 32) * bound) >> 32);
+}
+
+
+
+/////////////////////////// Hand class //////////////////////////////
+constexpr uint64_t Hand::bit(const Card& card)
+{
+    return uint64_t(1) << ((card.code() & 3) * suitBits + (card.code() >> 2));
+}
+
+constexpr unsigned Hand::suit(Card::SUIT suit) const
+{
+    return (m_mask >> ((unsigned(suit) - 1) * suitBits)) & suitMask;
+}
+
+constexpr unsigned Hand::ranks() const
+{
+    auto folded = m_mask | (m_mask >> 32);
+    return (folded | (folded >> suitBits)) & suitMask;
+}
+
+constexpr unsigned Hand::suitCount() const
+{
+    unsigned count = 0;
+    for(unsigned i = 0; i < 4; ++i) {
+        count += ((m_mask >> (i * suitBits)) & suitMask) != 0;
+    }
+    return count;
+}
+
+constexpr bool Hand::isFlush() const
+{
+    // All four lane popcounts at once: without hardware popcnt, std::popcount per
+    // lane costs more than the rest of the ranking. A lane count of 5..13 plus 11
+    // is the first to reach bit 4 of its lane.
+    auto count = m_mask - ((m_mask >> 1) & 0x5555555555555555);
+    count = (count & 0x3333333333333333) + ((count >> 2) & 0x3333333333333333);
+    count = (count + (count >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    count = (count + (count >> 8)) & 0x00FF00FF00FF00FF;
+    return (count + 0x000B000B000B000B) & 0x0010001000100010;
+}
+
+constexpr bool Hand::isStraight() const
+{                                                               // FYI - cards = [10, K, A, J, Q]
+    auto bits = ranks();                                        // FYI - bits = 1 1110 0000 0001
+    bits |= (bits & 1) << 13;                                   // FYI - the ace again above the K
+    return bits & (bits >> 1) & (bits >> 2) & (bits >> 3) & (bits >> 4);   // FYI - five in a row
+}
+
+static_assert(Hand({ { Card::SUIT::CLUB, Card::RANK::TEN }, { Card::SUIT::HEART, Card::RANK::J },
+                     { Card::SUIT::CLUB, Card::RANK::Q }, { Card::SUIT::CLUB, Card::RANK::K },
+                     { Card::SUIT::CLUB, Card::RANK::A } }).isStraight());
+static_assert(!Hand({ { Card::SUIT::CLUB, Card::RANK::Q }, { Card::SUIT::CLUB, Card::RANK::K },
+                      { Card::SUIT::CLUB, Card::RANK::A }, { Card::SUIT::CLUB, Card::RANK::TWO },
+                      { Card::SUIT::CLUB, Card::RANK::THREE } }).isStraight());
+
+
+
+/////////////////////////// Deck class //////////////////////////////
+constexpr Deck Deck::standard()
+{
+    Deck deck;
+    for(unsigned suit = 1; suit <= 4; ++suit) {
+        for(unsigned rank = 1; rank <= 13; ++rank) {
+            deck.add(Card(Card::SUIT(suit), Card::RANK(rank)));
+        }
+    }
+    return deck;
+}
+
+constexpr bool Deck::contains(const Card& card) const
+{
+    if(card.code() >= capacity) return false;
+    auto slot = m_slots[card.code()];
+    return slot < m_size && m_cards[slot].code() == card.code();
+}
+
+constexpr void Deck::add(const Card& card)
+{
+    if(card.code() >= capacity) {
+        throw std::out_of_range("invalid card code " + std::to_string(card.code()));
+    }
+    if(contains(card)) {
+        throw std::runtime_error("deck already holds this card");
+    }
+    m_slots[card.code()] = m_size;
+    m_cards[m_size++] = card;
+}
+
+inline const Card& Deck::at(unsigned i) const
+{
+    if(i >= m_size) {
+        throw std::out_of_range("deck index " + std::to_string(i));
+    }
+    return m_cards[i];
+}
+
+inline Card Deck::deal()
+{
+    if(!m_size) {
+        throw std::runtime_error("deck is empty");
+    }
+    return m_cards[--m_size];
+}
+
+inline bool Deck::remove(const Card& card)
+{
+    if(!contains(card)) return false;
+    swap(m_slots[card.code()], m_size - 1);
+    --m_size;
+    return true;
+}
+
+inline void Deck::swap(unsigned i, unsigned j)
+{
+    std::swap(m_cards[i], m_cards[j]);
+    m_slots[m_cards[i].code()] = i;
+    m_slots[m_cards[j].code()] = j;
+}
+
+inline void Deck::shuffle()
+{
+    thread_local Random random(std::random_device{}() | uint64_t(std::random_device{}()) << 32);
+    shuffle(random, totalCards());
+}
+
+inline void Deck::shuffle(Random& random, unsigned count)
+{                                                               // Fisher-Yates from the top, stopped after count steps
+    count = std::min(count, totalCards());
+    for(unsigned i = m_size; i > m_size - count; --i) {
+        swap(i - 1, random.below(i));
+    }
+}
+
+inline bool Deck::isFlush(CardList cards)
+{
+    return Hand(cards).suitCount() == 1;
+}
+
+inline bool Deck::isStraight(const std::array<Card, 5> &cards)
+{
+    return Hand(cards).isStraight();
+}
+
+static_assert(Deck::standard().totalCards() == Deck::capacity && sizeof(Deck) <= 128);
+
+
+
+/////////////////////////// HandBatch class //////////////////////////////
+inline void HandBatch::push(const Hand& hand)
+{
+    for(unsigned s = 0; s < 4; ++s) {
+        m_suits[s].push_back(uint16_t(hand.mask() >> (s * Hand::suitBits)));
+    }
+}
+
+inline Hand HandBatch::at(size_t i) const
+{
+    uint64_t mask = 0;
+    for(unsigned s = 0; s < 4; ++s) {
+        mask |= uint64_t(m_suits[s][i]) << (s * Hand::suitBits);
+    }
+    return Hand(mask);
+}
+
+
+/////////////////////////// HandEvaluator class //////////////////////////////
+constexpr unsigned HandEvaluator::straight(unsigned ranks)
+{
+    ranks |= (ranks & 1) << 13;
+    auto runs = ranks & (ranks >> 1) & (ranks >> 2) & (ranks >> 3) & (ranks >> 4);
+    return runs ? std::bit_width(runs) + 4 : 0;     // run starting at bit i tops out at value i + 5
+}
+
+constexpr uint32_t HandEvaluator::strength(CATEGORY category, std::initializer_list<unsigned> values)
+{
+    uint32_t result = uint32_t(category);
+    unsigned n = 0;
+    for(auto value: values) {
+        if(n++ < 5) result = (result << 4) | value;
+    }
+    for(; n < 5; ++n) result <<= 4;
+    return result;
+}
+
+constexpr uint32_t HandEvaluator::rankStrength(const Counts& counts)
+{
+    unsigned byCount[5][13] = {}, found[5] = {};    // values holding exactly n cards, high first
+    unsigned ranks = 0;
+    for(unsigned v = 14; v >= 2; --v) {
+        byCount[counts[v]][found[counts[v]]++] = v;
+        if(counts[v]) ranks |= 1u << (v == 14 ? 0 : v - 1);
+    }
+    auto kicker = [&](unsigned skip1, unsigned skip2, unsigned nth) {      // nth highest other value
+        for(unsigned v = 14; v >= 2; --v) {
+            if(counts[v] && v != skip1 && v != skip2 && nth-- == 0) return v;
+        }
+        return 0u;
+    };
+    auto& quads = byCount[4]; auto& trips = byCount[3]; auto& pairs = byCount[2];
+
+    if(found[4]) {
+        return strength(CATEGORY::QUADS, { quads[0], kicker(quads[0], 0, 0) });
+    }
+    if(found[3] && (found[3] > 1 || found[2])) {
+        return strength(CATEGORY::FULL_HOUSE, { trips[0], std::max(trips[1], pairs[0]) });
+    }
+    if(auto top = straight(ranks)) {
+        return strength(CATEGORY::STRAIGHT, { top });
+    }
+    if(found[3]) {
+        return strength(CATEGORY::TRIPS, { trips[0], kicker(trips[0], 0, 0), kicker(trips[0], 0, 1) });
+    }
+    if(found[2] > 1) {
+        return strength(CATEGORY::TWO_PAIR, { pairs[0], pairs[1], kicker(pairs[0], pairs[1], 0) });
+    }
+    if(found[2]) {
+        return strength(CATEGORY::PAIR, { pairs[0], kicker(pairs[0], 0, 0), kicker(pairs[0], 0, 1),
+                                          kicker(pairs[0], 0, 2) });
+    }
+    auto& singles = byCount[1];
+    return strength(CATEGORY::HIGH_CARD, { singles[0], singles[1], singles[2], singles[3], singles[4] });
+}
+
+constexpr std::array<uint32_t, 8192> HandEvaluator::makeFlushTable()
+{
+    std::array<uint32_t, 8192> table = {};
+    for(unsigned lane = 0; lane < table.size(); ++lane) {
+        if(std::popcount(lane) < 5) continue;
+        if(auto top = straight(lane)) {
+            table[lane] = strength(CATEGORY::STRAIGHT_FLUSH, { top });
+            continue;
+        }
+        unsigned values[5] = {}, n = 0;
+        for(unsigned v = 14; v >= 2 && n < 5; --v) {
+            if(lane & (1u << (v == 14 ? 0 : v - 1))) values[n++] = v;
+        }
+        table[lane] = strength(CATEGORY::FLUSH, { values[0], values[1], values[2], values[3], values[4] });
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 8192> HandEvaluator::makeKeyTable()
+{
+    std::array<uint32_t, 8192> table = {};
+    for(unsigned lane = 0; lane < table.size(); ++lane) {
+        uint32_t power = 1;
+        for(unsigned bit = 0; bit < 13; ++bit, power *= 5) {
+            if(lane & (1u << bit)) table[lane] += power;
+        }
+    }
+    return table;
+}
+
+inline constexpr std::array<uint32_t, 8192> HandEvaluator::m_flushTable = HandEvaluator::makeFlushTable();
+inline constexpr std::array<uint32_t, 8192> HandEvaluator::m_keyTable = HandEvaluator::makeKeyTable();
+inline std::atomic<const HandEvaluator::Kernels*> HandEvaluator::m_forced { nullptr };
+
+// Hash-and-displace over every rank multiset of 5..7 cards (73775 keys): keys are
+// split into buckets, and the largest buckets pick a seed first until all of their
+// keys land in free slots. A lookup is then one seed read and one strength read.
+inline HandEvaluator::HandEvaluator()
+{
+    std::vector<std::pair<uint32_t, uint32_t>> entries;     // key, strength
+    Counts counts = {};
+    auto collect = [&](auto& self, unsigned bit, unsigned cards, uint32_t key, uint32_t power) -> void {
+        if(bit == 13) {
+            if(cards >= 5) entries.emplace_back(key, rankStrength(counts));
+            return;
+        }
+        for(unsigned n = 0; n <= 4 && cards + n <= 7; ++n) {
+            counts[value(bit)] = n;
+            self(self, bit + 1, cards + n, key + n * power, power * 5);
+        }
+        counts[value(bit)] = 0;
+    };
+    collect(collect, 0, 0, 0, 1);
+
+    m_seeds.assign(1u << bucketBits, 0);
+    m_strengths.assign(entries.size() + entries.size() / 8, 0);
+
+    std::vector<std::vector<uint32_t>> buckets(m_seeds.size());
+    for(uint32_t i = 0; i < entries.size(); ++i) {
+        buckets[bucket(entries[i].first)].push_back(i);
+    }
+    std::vector<uint32_t> order(buckets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    std::vector<bool> used(m_strengths.size());
+    std::vector<uint32_t> slots;
+    for(auto b: order) {
+        if(buckets[b].empty()) break;
+        for(uint32_t seed = 1;; ++seed) {
+            slots.clear();
+            for(auto i: buckets[b]) {
+                auto s = slot(entries[i].first, seed);
+                if(used[s] || std::find(slots.begin(), slots.end(), s) != slots.end()) break;
+                slots.push_back(s);
+            }
+            if(slots.size() != buckets[b].size()) continue;
+            for(size_t j = 0; j < slots.size(); ++j) {
+                used[slots[j]] = true;
+                m_strengths[slots[j]] = entries[buckets[b][j]].second;
+            }
+            m_seeds[b] = seed;
+            break;
+        }
+    }
+}
+
+inline const HandEvaluator& HandEvaluator::instance()
+{
+    static const HandEvaluator evaluator;
+    return evaluator;
+}
+
+// 32-bit arithmetic only, so the vector kernels compute the same slots with mullo.
+inline uint32_t HandEvaluator::bucket(uint32_t key)
+{
+    return (key * 0x9E3779B1u) >> (32 - bucketBits);
+}
+
+inline uint32_t HandEvaluator::slot(uint32_t key, uint32_t seed) const
+{
+    uint32_t hash = (key ^ seed) * 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return uint32_t((uint64_t(hash) * m_strengths.size()) >> 32);
+}
+
+inline uint32_t HandEvaluator::lookup(uint32_t key) const
+{
+    return m_strengths[slot(key, m_seeds[bucket(key)])];
+}
+
+inline uint32_t HandEvaluator::evaluate(const Hand& hand)
+{
+    uint32_t flush = 0, key = 0;
+    for(unsigned i = 0; i < 4; ++i) {
+        auto lane = (hand.mask() >> (i * Hand::suitBits)) & Hand::suitMask;
+        flush |= m_flushTable[lane];        // at most one suit can hold five of seven cards
+        key += m_keyTable[lane];
+    }
+    return flush ? flush : instance().lookup(key);
+}
+
+inline void HandEvaluator::classify(const HandBatch& batch, uint8_t* flags)
+{
+    selected().classify(batch, flags, 0, batch.size());
+}
+
+inline void HandEvaluator::evaluate(const HandBatch& batch, uint32_t* strengths)
+{
+    instance();     // build the hash before a kernel reads it
+    selected().evaluate(batch, strengths, 0, batch.size());
+}
+
+inline const char* HandEvaluator::kernel()
+{
+    return selected().name;
+}
+
+inline std::vector<std::string> HandEvaluator::kernels()
+{
+    std::vector<std::string> names;
+    for(auto& candidate: supported()) names.push_back(candidate.name);
+    return names;
+}
+
+inline bool HandEvaluator::setKernel(const std::string& name)
+{
+    for(auto& candidate: supported()) {
+        if(name == candidate.name) {
+            m_forced.store(&candidate, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline const std::vector<HandEvaluator::Kernels>& HandEvaluator::supported()
+{
+    static const std::vector<Kernels> available = [] {
+        std::vector<Kernels> found;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) found.push_back({ classifyAvx2, evaluateAvx2, "avx2" });
+        // without gathers the table reads dominate and SSE evaluate measured slower than scalar
+        if(__builtin_cpu_supports("sse4.1")) found.push_back({ classifySse41, evaluateScalar, "sse4.1" });
+#endif
+        found.push_back({ classifyScalar, evaluateScalar, "scalar" });
+        return found;
+    }();
+    return available;
+}
+
+inline const HandEvaluator::Kernels& HandEvaluator::selected()
+{
+    auto forced = m_forced.load(std::memory_order_acquire);
+    return forced ? *forced : supported().front();
+}
+
+inline void HandEvaluator::classifyScalar(const HandBatch& batch, uint8_t* flags, size_t begin, size_t end)
+{
+    for(auto i = begin; i < end; ++i) {
+        auto hand = batch.at(i);
+        flags[i] = (hand.isFlush() ? FLUSH : 0) | (hand.isStraight() ? STRAIGHT : 0);
+    }
+}
+
+inline void HandEvaluator::evaluateScalar(const HandBatch& batch, uint32_t* strengths, size_t begin, size_t end)
+{
+    for(auto i = begin; i < end; ++i) {
+        strengths[i] = evaluate(batch.at(i));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The kernels follow the scalar code step for step: popcount >= 5 per suit lane
+// (nibble lookup through pshufb) and the shift-AND straight test on the OR of the
+// lanes; evaluate gathers both lane tables, then hashes the key exactly like slot().
+__attribute__((target("sse4.1")))
+inline void HandEvaluator::classifySse41(const HandBatch& batch, uint8_t* flags, size_t begin, size_t end)
+{
+    const __m128i nibbles = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i low = _mm_set1_epi8(0x0F), byte = _mm_set1_epi16(0xFF), four = _mm_set1_epi16(4);
+    const __m128i ace = _mm_set1_epi16(1);
+    auto i = begin;
+    for(; i + 8 <= end; i += 8) {
+        __m128i flush = _mm_setzero_si128(), ranks = _mm_setzero_si128();
+        for(unsigned s = 0; s < 4; ++s) {
+            auto lane = _mm_loadu_si128(reinterpret_cast<const __m128i*>(batch.suit(s) + i));
+            auto bytes = _mm_add_epi8(_mm_shuffle_epi8(nibbles, _mm_and_si128(lane, low)),
+                                      _mm_shuffle_epi8(nibbles, _mm_and_si128(_mm_srli_epi16(lane, 4), low)));
+            auto count = _mm_add_epi16(_mm_and_si128(bytes, byte), _mm_srli_epi16(bytes, 8));
+            flush = _mm_or_si128(flush, _mm_cmpgt_epi16(count, four));
+            ranks = _mm_or_si128(ranks, lane);
+        }
+        ranks = _mm_or_si128(ranks, _mm_slli_epi16(_mm_and_si128(ranks, ace), 13));
+        auto runs = _mm_and_si128(_mm_and_si128(ranks, _mm_srli_epi16(ranks, 1)),
+                                  _mm_and_si128(_mm_srli_epi16(ranks, 2), _mm_srli_epi16(ranks, 3)));
+        runs = _mm_and_si128(runs, _mm_srli_epi16(ranks, 4));
+        auto straight = _mm_andnot_si128(_mm_cmpeq_epi16(runs, _mm_setzero_si128()), _mm_set1_epi16(STRAIGHT));
+        auto result = _mm_or_si128(_mm_and_si128(flush, _mm_set1_epi16(FLUSH)), straight);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(flags + i), _mm_packus_epi16(result, result));
+    }
+    classifyScalar(batch, flags, i, end);
+}
+
+__attribute__((target("avx2")))
+inline void HandEvaluator::classifyAvx2(const HandBatch& batch, uint8_t* flags, size_t begin, size_t end)
+{
+    const __m256i nibbles = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                             0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0F), byte = _mm256_set1_epi16(0xFF), four = _mm256_set1_epi16(4);
+    const __m256i ace = _mm256_set1_epi16(1);
+    auto i = begin;
+    for(; i + 16 <= end; i += 16) {
+        __m256i flush = _mm256_setzero_si256(), ranks = _mm256_setzero_si256();
+        for(unsigned s = 0; s < 4; ++s) {
+            auto lane = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch.suit(s) + i));
+            auto bytes = _mm256_add_epi8(_mm256_shuffle_epi8(nibbles, _mm256_and_si256(lane, low)),
+                                         _mm256_shuffle_epi8(nibbles, _mm256_and_si256(_mm256_srli_epi16(lane, 4), low)));
+            auto count = _mm256_add_epi16(_mm256_and_si256(bytes, byte), _mm256_srli_epi16(bytes, 8));
+            flush = _mm256_or_si256(flush, _mm256_cmpgt_epi16(count, four));
+            ranks = _mm256_or_si256(ranks, lane);
+        }
+        ranks = _mm256_or_si256(ranks, _mm256_slli_epi16(_mm256_and_si256(ranks, ace), 13));
+        auto runs = _mm256_and_si256(_mm256_and_si256(ranks, _mm256_srli_epi16(ranks, 1)),
+                                     _mm256_and_si256(_mm256_srli_epi16(ranks, 2), _mm256_srli_epi16(ranks, 3)));
+        runs = _mm256_and_si256(runs, _mm256_srli_epi16(ranks, 4));
+        auto straight = _mm256_andnot_si256(_mm256_cmpeq_epi16(runs, _mm256_setzero_si256()), _mm256_set1_epi16(STRAIGHT));
+        auto result = _mm256_or_si256(_mm256_and_si256(flush, _mm256_set1_epi16(FLUSH)), straight);
+        auto packed = _mm_packus_epi16(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(flags + i), packed);
+    }
+    classifyScalar(batch, flags, i, end);
+}
+
+__attribute__((target("avx2")))
+inline void HandEvaluator::evaluateAvx2(const HandBatch& batch, uint32_t* strengths, size_t begin, size_t end)
+{
+    auto& tables = instance();
+    auto flushTable = reinterpret_cast<const int*>(m_flushTable.data());
+    auto keyTable = reinterpret_cast<const int*>(m_keyTable.data());
+    auto seeds = reinterpret_cast<const int*>(tables.m_seeds.data());
+    auto values = reinterpret_cast<const int*>(tables.m_strengths.data());
+    const __m256i size = _mm256_set1_epi32(tables.m_strengths.size());
+    auto i = begin;
+    for(; i + 8 <= end; i += 8) {
+        __m256i flush = _mm256_setzero_si256(), key = _mm256_setzero_si256();
+        for(unsigned s = 0; s < 4; ++s) {
+            auto lane = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(batch.suit(s) + i)));
+            flush = _mm256_or_si256(flush, _mm256_i32gather_epi32(flushTable, lane, 4));
+            key = _mm256_add_epi32(key, _mm256_i32gather_epi32(keyTable, lane, 4));
+        }
+        auto bucket = _mm256_srli_epi32(_mm256_mullo_epi32(key, _mm256_set1_epi32(0x9E3779B1u)), 32 - bucketBits);
+        auto hash = _mm256_xor_si256(key, _mm256_i32gather_epi32(seeds, bucket, 4));
+        hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(0x85EBCA6Bu));
+        hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 13));
+        hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(0xC2B2AE35u));
+        hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 16));
+        auto even = _mm256_srli_epi64(_mm256_mul_epu32(hash, size), 32);
+        auto odd = _mm256_mul_epu32(_mm256_srli_epi64(hash, 32), size);
+        auto rank = _mm256_i32gather_epi32(values, _mm256_blend_epi32(even, odd, 0xAA), 4);
+        auto noFlush = _mm256_cmpeq_epi32(flush, _mm256_setzero_si256());
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(strengths + i), _mm256_blendv_epi8(flush, rank, noFlush));
+    }
+    evaluateScalar(batch, strengths, i, end);
+}
+#endif
+
+
+
+/////////////////////////// EquitySimulator class //////////////////////////////
+inline EquitySimulator::EquitySimulator(const std::vector<Hand>& holes, const Hand& board) : m_holes(holes), m_board(board)
+{
+    if(holes.size() < 2 || holes.size() > maxPlayers) {
+        throw std::runtime_error("equity needs 2 to " + std::to_string(maxPlayers) + " players");
+    }
+    auto known = board.mask();
+    for(auto& hole: holes) {
+        if(hole.size() != 2 || (known & hole.mask())) {
+            throw std::runtime_error("hole cards must be two cards not used elsewhere");
+        }
+        known |= hole.mask();
+    }
+    if(board.size() > 5) {
+        throw std::runtime_error("board holds at most five cards");
+    }
+    m_deck = Deck::standard();
+    for(uint8_t code = 0; code < Deck::capacity; ++code) {
+        if(known & Hand::bit(Card::fromCode(code))) m_deck.remove(Card::fromCode(code));
+    }
+    for(unsigned i = 0; i < m_deck.totalCards(); ++i) {
+        m_stub.push_back(Hand::bit(m_deck.at(i)));
+    }
+}
+
+inline unsigned EquitySimulator::threadCount(unsigned threads, uint64_t chunks)
+{
+    if(!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+    return unsigned(std::max<uint64_t>(1, std::min<uint64_t>(threads, chunks)));
+}
+
+inline std::vector<EquitySimulator::Player> EquitySimulator::run(uint64_t trials, uint64_t seed, unsigned threads) const
+{
+    uint64_t chunks = (trials + chunkTrials - 1) / chunkTrials;
+    threads = threadCount(threads, chunks);
+
+    std::vector<Tally> tallies(threads);
+    ChunkQueue::run(chunks, threads, [&](unsigned thread, uint64_t chunk) {
+        simulate(chunk, std::min(chunkTrials, trials - chunk * chunkTrials), seed, tallies[thread]);
+    });
+    return total(tallies, trials, true);
+}
+
+inline std::vector<EquitySimulator::Player> EquitySimulator::enumerate(unsigned threads) const
+{
+    auto count = boards();
+    uint64_t chunks = (count + chunkTrials - 1) / chunkTrials;
+    threads = threadCount(threads, chunks);
+
+    std::vector<Tally> tallies(threads);
+    ChunkQueue::run(chunks, threads, [&](unsigned thread, uint64_t chunk) {
+        walk(chunk * chunkTrials, std::min(chunkTrials, count - chunk * chunkTrials), tallies[thread]);
+    });
+    return total(tallies, count, false);
+}
+
+inline uint64_t EquitySimulator::boards() const
+{
+    return Combinations::binomial(m_stub.size(), 5 - m_board.size());
+}
+
+inline std::vector<EquitySimulator::Player> EquitySimulator::total(const std::vector<Tally>& tallies, uint64_t trials, bool sampled) const
+{
+    std::vector<Player> players(m_holes.size());
+    for(size_t p = 0; p < players.size(); ++p) {
+        uint64_t shares = 0, squares = 0;
+        for(auto& tally: tallies) {
+            players[p].wins += tally.wins[p];
+            players[p].ties += tally.ties[p];
+            players[p].losses += tally.losses[p];
+            shares += tally.shares[p];
+            squares += tally.squares[p];
+        }
+        if(!trials) continue;
+        auto mean = double(shares) / shareUnit / trials;
+        auto variance = std::max(0.0, double(squares) / (shareUnit * shareUnit) / trials - mean * mean);
+        players[p].equity = mean;
+        players[p].stdError = sampled ? std::sqrt(variance / trials) : 0;
+    }
+    return players;
+}
+
+inline void EquitySimulator::simulate(uint64_t chunk, uint64_t trials, uint64_t seed, Tally& tally) const
+{
+    Random random(seed ^ (chunk * 0xD1B54A32D192ED03ull));
+    auto deck = m_deck;             // fresh order per chunk keeps the draws independent of scheduling
+    auto missing = 5 - m_board.size(), top = deck.totalCards() - 1;
+
+    for(uint64_t trial = 0; trial < trials; ++trial) {
+        deck.shuffle(random, missing);
+        auto board = m_board.mask();
+        for(unsigned i = 0; i < missing; ++i) {
+            board |= Hand::bit(deck.at(top - i));
+        }
+        showdown(board, tally);
+    }
+}
+
+inline void EquitySimulator::walk(uint64_t first, uint64_t count, Tally& tally) const
+{
+    Combinations runouts(m_stub, 5 - m_board.size(), first);
+    for(uint64_t step = 0; step < count; ++step) {
+        showdown(m_board.mask() | runouts.mask(), tally);
+        if(!runouts.next()) break;
+    }
+}
+
+inline void EquitySimulator::showdown(uint64_t board, Tally& tally) const
+{
+    auto players = m_holes.size();
+    std::array<uint32_t, maxPlayers> strengths;
+    uint32_t best = 0;
+    for(size_t p = 0; p < players; ++p) {
+        strengths[p] = HandEvaluator::evaluate(Hand(board | m_holes[p].mask()));
+        best = std::max(best, strengths[p]);
+    }
+    unsigned winners = 0;
+    for(size_t p = 0; p < players; ++p) {
+        winners += strengths[p] == best;
+    }
+    auto share = shareUnit / winners;
+    for(size_t p = 0; p < players; ++p) {
+        if(strengths[p] != best) {
+            ++tally.losses[p];
+            continue;
+        }
+        ++(winners == 1 ? tally.wins[p] : tally.ties[p]);
+        tally.shares[p] += share;
+        tally.squares[p] += share * share;
+    }
+}
+
+
+
+/////////////////////////// ChunkQueue class //////////////////////////////
+inline ChunkQueue::ChunkQueue(uint64_t chunks, unsigned threads) : m_ranges(threads)
+{
+    for(unsigned t = 0; t < threads; ++t) {
+        m_ranges[t] = (chunks * t / threads) << 32 | (chunks * (t + 1) / threads);
+    }
+}
+
+inline void ChunkQueue::run(uint64_t chunks, unsigned threads, const std::function<void(unsigned, uint64_t)>& work)
+{
+    ChunkQueue queue(chunks, threads);
+    if(threads == 1) {      // already on a worker, e.g. a service's compute pool
+        uint64_t chunk;
+        while(queue.next(0, chunk)) work(0, chunk);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for(unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&queue, &work, t] {
+            uint64_t chunk;
+            while(queue.next(t, chunk)) {
+                work(t, chunk);
+            }
+        });
+    }
+    for(auto& worker: workers) {
+        worker.join();
+    }
+}
+
+inline bool ChunkQueue::next(unsigned thread, uint64_t& chunk)
+{
+    do {
+        if(take(thread, chunk)) return true;
+    } while(steal(thread));
+    return false;
+}
+
+inline bool ChunkQueue::take(unsigned thread, uint64_t& chunk)
+{
+    auto range = m_ranges[thread].load();
+    while((range >> 32) < (range & 0xFFFFFFFF)) {
+        if(m_ranges[thread].compare_exchange_weak(range, range + (uint64_t(1) << 32))) {
+            chunk = range >> 32;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool ChunkQueue::steal(unsigned thread)
+{
+    auto threads = m_ranges.size();
+    for(size_t i = 1; i < threads; ++i) {
+        auto& victim = m_ranges[(thread + i) % threads];
+        auto range = victim.load();
+        uint64_t begin, end;
+        while((begin = range >> 32) + 1 < (end = range & 0xFFFFFFFF)) {
+            auto middle = begin + (end - begin) / 2;
+            if(victim.compare_exchange_weak(range, begin << 32 | middle)) {
+                m_ranges[thread] = middle << 32 | end;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+
+/////////////////////////// Combinations class //////////////////////////////
+inline Combinations::Combinations(const std::vector<uint64_t>& cards, unsigned k, uint64_t first) : m_cards(cards), m_k(k)
+{
+    for(unsigned i = k; i > 0; --i) {
+        unsigned position = i - 1;
+        while(binomial(position + 1, i) <= first) ++position;
+        first -= binomial(position, i);
+        m_positions[i - 1] = position;
+        m_mask |= m_cards[position];
+    }
+}
+
+inline bool Combinations::next()
+{
+    auto& c = m_positions;
+    unsigned j = 0;
+    while(j < m_k && c[j] + 1 == (j + 1 < m_k ? c[j + 1] : m_cards.size())) ++j;
+    if(j == m_k) return false;
+    m_mask ^= m_cards[c[j]] ^ m_cards[c[j] + 1];
+    ++c[j];
+    for(unsigned i = 0; i < j; ++i) {
+        m_mask ^= m_cards[c[i]] ^ m_cards[i];
+        c[i] = i;
+    }
+    return true;
+}
+
+constexpr uint64_t Combinations::binomial(unsigned n, unsigned k)
+{
+    if(k > n) return 0;
+    uint64_t result = 1;
+    for(unsigned i = 1; i <= k; ++i) {
+        result = result * (n - k + i) / i;      // stays exact, each prefix is a binomial itself
+    }
+    return result;
+}
+
+
+
+/////////////////////////// Range class //////////////////////////////
+inline Range::Range(const std::string& notation)
+{
+    std::string token;
+    for(auto c: notation + ",") {
+        if(c == ',') {
+            if(!token.empty()) addToken(token);
+            token.clear();
+        }
+        else if(!isspace((unsigned char)c)) {
+            token += c;
+        }
+    }
+}
+
+inline void Range::addToken(const std::string& token)
+{
+    static const std::string ranks = "23456789TJQKA", suits = "hdcs";
+    auto bad = [&]() { return std::runtime_error("bad range token '" + token + "'"); };
+    auto value = [&](char c) {
+        auto found = ranks.find(toupper((unsigned char)c));
+        if(found == std::string::npos) throw bad();
+        return unsigned(found) + 2;
+    };
+    auto card = [&](char rank, char suit) {
+        auto found = suits.find(tolower((unsigned char)suit));
+        if(found == std::string::npos) throw bad();
+        auto v = value(rank);
+        return Card(Card::SUIT(found + 1), Card::RANK(v == 14 ? 1 : v));
+    };
+
+    if(token.size() == 4 && suits.find(tolower((unsigned char)token[1])) != std::string::npos) {
+        auto first = card(token[0], token[1]), second = card(token[2], token[3]);
+        if(first.code() == second.code()) throw bad();
+        add(Hand({ first, second }));
+        return;
+    }
+
+    // "XY[s|o]" optionally followed by "+" or "-XZ[s|o]"
+    auto dash = token.find('-');
+    auto head = token.substr(0, dash);
+    bool plus = !head.empty() && head.back() == '+';
+    if(plus) head.pop_back();
+    if(head.size() < 2 || head.size() > 3) throw bad();
+    unsigned high = value(head[0]), low = value(head[1]);
+    char kind = head.size() == 3 ? char(tolower((unsigned char)head[2])) : 0;
+    bool pair = high == low;
+    if((kind && kind != 's' && kind != 'o') || (pair && kind) || low > high) throw bad();
+
+    unsigned last = low;
+    if(plus) {
+        last = pair ? 14 : high - 1;
+    }
+    else if(dash != std::string::npos) {
+        auto tail = token.substr(dash + 1);
+        if(tail.size() != head.size() || (kind && tolower((unsigned char)tail[2]) != kind) ||
+           value(tail[0]) != (pair ? value(tail[1]) : high)) throw bad();
+        last = value(tail[1]);
+    }
+    if(last < low) std::swap(last, low);
+    for(unsigned v = low; v <= last; ++v) {
+        if(pair) addClass(v, v, 0);
+        else addClass(high, v, kind);
+    }
+}
+
+inline void Range::addClass(unsigned high, unsigned low, char kind)
+{
+    auto rank = [](unsigned v) { return Card::RANK(v == 14 ? 1 : v); };
+    for(unsigned s1 = 1; s1 <= 4; ++s1) {
+        for(unsigned s2 = 1; s2 <= 4; ++s2) {
+            if(high == low ? s2 <= s1 : (kind == 's' && s1 != s2) || (kind == 'o' && s1 == s2)) continue;
+            add(Hand({ Card(Card::SUIT(s1), rank(high)), Card(Card::SUIT(s2), rank(low)) }));
+        }
+    }
+}
+
+inline void Range::add(const Hand& combo)
+{
+    auto at = std::lower_bound(m_combos.begin(), m_combos.end(), combo,
+                               [](const Hand& a, const Hand& b) { return a.mask() < b.mask(); });
+    if(at == m_combos.end() || at->mask() != combo.mask()) m_combos.insert(at, combo);
+}
+
+inline bool Range::contains(uint64_t mask) const
+{
+    return std::binary_search(m_combos.begin(), m_combos.end(), Hand(mask),
+                              [](const Hand& a, const Hand& b) { return a.mask() < b.mask(); });
+}
+
+inline uint64_t Range::id() const
+{
+    uint64_t state = m_combos.size(), hash = 0;
+    for(auto& combo: m_combos) {
+        state ^= combo.mask();
+        hash = (hash ^ Random::splitmix(state)) * 0x9E3779B97F4A7C15ull;
+    }
+    return hash;
+}
+
+inline bool Range::isSymmetric() const
+{
+    // the transpositions of neighbouring suits generate every permutation
+    for(unsigned s = 0; s < 3; ++s) {
+        std::array<unsigned, 4> swapped = { 0, 1, 2, 3 };
+        std::swap(swapped[s], swapped[s + 1]);
+        for(auto& combo: m_combos) {
+            if(!contains(permute(combo.mask(), swapped))) return false;
+        }
+    }
+    return true;
+}
+
+inline uint64_t Range::permute(uint64_t mask, const std::array<unsigned, 4>& suits)
+{
+    uint64_t result = 0;
+    for(unsigned s = 0; s < 4; ++s) {
+        result |= ((mask >> (s * Hand::suitBits)) & Hand::suitMask) << (suits[s] * Hand::suitBits);
+    }
+    return result;
+}
+
+
+
+/////////////////////////// RangeEquity class //////////////////////////////
+inline size_t RangeEquity::KeyHash::operator () (const Key& key) const
+{
+    uint64_t state = key.board;
+    auto hash = Random::splitmix(state) ^ key.hero;
+    state = hash;
+    return Random::splitmix(state) ^ key.villain;
+}
+
+inline RangeEquity::RangeEquity(unsigned threads) : m_threads(threads)
+{
+    for(unsigned n = 0; n <= 5; ++n) {
+        m_boards.emplace_back(std::vector<unsigned>{ n });
+        m_runouts.emplace_back(std::vector<unsigned>{ n, 5 - n });
+    }
+}
+
+inline RangeEquity::Result RangeEquity::compare(const Range& hero, const Range& villain, const Hand& board)
+{
+    if(board.size() > 5) {
+        throw std::runtime_error("board holds at most five cards");
+    }
+    bool symmetric = hero.isSymmetric() && villain.isSymmetric();
+    auto canonical = symmetric ? m_boards[board.size()].canonical({ board })[0] : board;
+    Key key = { canonical.mask(), hero.id(), villain.id() };
+
+    Result result;
+    if(m_cache.find(key, result)) return result;
+    result = solve(hero, villain, canonical, symmetric);
+    m_cache.insert(key, result);
+    return result;
+}
+
+inline RangeEquity::Result RangeEquity::solve(const Range& hero, const Range& villain, const Hand& board, bool symmetric) const
+{
+    // combos of both ranges ranked once per runout, indexed through these
+    std::vector<uint64_t> combos;
+    std::vector<uint32_t> heroIndex, villainIndex;
+    auto index = [&](const Range& range, std::vector<uint32_t>& indices) {
+        for(auto& combo: range.combos()) {
+            if(combo.mask() & board.mask()) continue;
+            auto found = std::find(combos.begin(), combos.end(), combo.mask());
+            indices.push_back(uint32_t(found - combos.begin()));
+            if(found == combos.end()) combos.push_back(combo.mask());
+        }
+    };
+    index(hero, heroIndex);
+    index(villain, villainIndex);
+
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    for(auto h: heroIndex) {
+        for(auto v: villainIndex) {
+            if(!(combos[h] & combos[v])) pairs.emplace_back(h, v);
+        }
+    }
+
+    Result result;
+    auto deck = Deck::standard();
+    for(uint8_t code = 0; code < Deck::capacity; ++code) {
+        if(board.contains(Card::fromCode(code))) deck.remove(Card::fromCode(code));
+    }
+    std::vector<uint64_t> stub;
+    for(unsigned i = 0; i < deck.totalCards(); ++i) {
+        stub.push_back(Hand::bit(deck.at(i)));
+    }
+    auto missing = 5 - board.size();
+    result.sampled = Combinations::binomial(stub.size(), missing) > exactBoards;
+    result.boards = exactBoards;
+
+    std::vector<std::pair<uint64_t, uint64_t>> runouts;         // board with runout, weight
+    if(!result.sampled) {
+        std::unordered_map<uint64_t, size_t> classes;
+        Combinations walk(stub, missing);
+        do {
+            if(!symmetric) {
+                runouts.emplace_back(board.mask() | walk.mask(), 1);
+                continue;
+            }
+            auto [found, added] = classes.emplace(m_runouts[board.size()].index({ board, Hand(walk.mask()) }), runouts.size());
+            if(added) runouts.emplace_back(board.mask() | walk.mask(), 0);
+            ++runouts[found->second].second;
+        } while(walk.next());
+        result.boards = runouts.size();
+    }
+    if(pairs.empty()) return result;
+
+    uint64_t chunks = (result.boards + chunkBoards - 1) / chunkBoards;
+    unsigned threads = m_threads ? m_threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = unsigned(std::min<uint64_t>(threads, chunks));
+    std::vector<Tally> tallies(threads);
+
+    ChunkQueue::run(chunks, threads, [&](unsigned thread, uint64_t chunk) {
+        HandBatch batch(combos.size());
+        std::vector<uint32_t> strengths(combos.size());
+        auto& tally = tallies[thread];
+        auto count = std::min(chunkBoards, result.boards - chunk * chunkBoards);
+
+        auto rank = [&](uint64_t runout, uint64_t weight) {
+            batch.clear();
+            for(auto combo: combos) {
+                batch.push(Hand(runout | combo));
+            }
+            HandEvaluator::evaluate(batch, strengths.data());
+            for(auto [h, v]: pairs) {
+                if((combos[h] | combos[v]) & runout) continue;
+                tally.halves += weight * (strengths[h] > strengths[v] ? 2 : strengths[h] == strengths[v]);
+                tally.matchups += weight;
+            }
+        };
+        if(result.sampled) {
+            Random random(chunk * 0xD1B54A32D192ED03ull);
+            auto cards = deck;
+            for(uint64_t i = 0; i < count; ++i) {
+                cards.shuffle(random, missing);
+                auto runout = board.mask();
+                for(unsigned j = 0; j < missing; ++j) {
+                    runout |= Hand::bit(cards.at(cards.totalCards() - 1 - j));
+                }
+                rank(runout, 1);
+            }
+        }
+        else {
+            for(auto i = chunk * chunkBoards; i < chunk * chunkBoards + count; ++i) {
+                rank(runouts[i].first, runouts[i].second);
+            }
+        }
+    });
+
+    uint64_t halves = 0;
+    for(auto& tally: tallies) {
+        halves += tally.halves;
+        result.matchups += tally.matchups;
+    }
+    result.equity = result.matchups ? double(halves) / 2 / result.matchups : 0;
+    return result;
+}
+
+
+
+/////////////////////////// HandIndexer class //////////////////////////////
+inline HandIndexer::HandIndexer(const std::vector<unsigned>& rounds) : m_rounds(rounds)
+{
+    unsigned total = std::accumulate(rounds.begin(), rounds.end(), 0u);
+    if(rounds.empty() || rounds.size() > maxRounds || total > 13 * 4) {
+        throw std::runtime_error("hand indexer needs 1 to " + std::to_string(maxRounds) + " rounds of cards");
+    }
+
+    // every way to spread each round over the four suits, up to suit order
+    std::vector<std::array<Sizes, 4>> configs;
+    std::array<Sizes, 4> sizes = {};
+    std::array<unsigned, 4> used = {};
+    auto spread = [&](auto& self, unsigned round, unsigned suit, unsigned left) -> void {
+        if(round == rounds.size()) {
+            auto sorted = sizes;
+            std::sort(sorted.begin(), sorted.end(), std::greater<Sizes>());
+            if(sorted == sizes) configs.push_back(sizes);
+            return;
+        }
+        if(suit == 3) {
+            if(left > 13 - used[3]) return;
+            sizes[3][round] = left;
+            used[3] += left;
+            self(self, round + 1, 0, round + 1 < rounds.size() ? rounds[round + 1] : 0);
+            used[3] -= left;
+            return;
+        }
+        for(unsigned n = 0; n <= std::min(left, 13 - used[suit]); ++n) {
+            sizes[suit][round] = n;
+            used[suit] += n;
+            self(self, round, suit + 1, left - n);
+            used[suit] -= n;
+        }
+    };
+    spread(spread, 0, 0, rounds[0]);
+
+    std::sort(configs.begin(), configs.end(), [](auto& a, auto& b) { return key(a) < key(b); });
+    for(auto& config: configs) {
+        m_keys.push_back(key(config));
+        m_configs.push_back({ config, m_size });
+        m_size += forGroups(config, [](unsigned, unsigned, uint64_t) {});
+    }
+}
+
+inline uint64_t HandIndexer::key(const std::array<Sizes, 4>& sizes)
+{
+    uint64_t result = 0;
+    for(auto& suit: sizes) {
+        for(auto n: suit) {
+            result = result << 4 | n;
+        }
+    }
+    return result;
+}
+
+// Calls f(first suit, suits in group, configurations per suit) for each run of
+// suits with equal sizes and returns how many hands the configuration holds.
+template <class F>
+inline uint64_t HandIndexer::forGroups(const std::array<Sizes, 4>& sizes, F&& f) const
+{
+    uint64_t total = 1;
+    for(unsigned first = 0, last; first < 4; first = last) {
+        for(last = first + 1; last < 4 && sizes[last] == sizes[first]; ++last);
+        auto n = suitSize(sizes[first]);
+        f(first, last - first, n);
+        total *= Combinations::binomial(n + last - first - 1, last - first);    // multisets of that many suits
+    }
+    return total;
+}
+
+inline uint64_t HandIndexer::suitSize(const Sizes& sizes) const
+{
+    uint64_t result = 1;
+    unsigned used = 0;
+    for(unsigned r = 0; r < m_rounds.size(); ++r) {
+        result *= Combinations::binomial(13 - used, sizes[r]);
+        used += sizes[r];
+    }
+    return result;
+}
+
+inline std::array<HandIndexer::Suit, 4> HandIndexer::split(const std::vector<Hand>& hand) const
+{
+    if(hand.size() != m_rounds.size()) {
+        throw std::runtime_error("hand has " + std::to_string(hand.size()) + " rounds, indexer " + std::to_string(m_rounds.size()));
+    }
+    uint64_t seen = 0;
+    for(unsigned r = 0; r < hand.size(); ++r) {
+        if(hand[r].size() != m_rounds[r] || (seen & hand[r].mask())) {
+            throw std::runtime_error("round " + std::to_string(r) + " needs " + std::to_string(m_rounds[r]) + " new cards");
+        }
+        seen |= hand[r].mask();
+    }
+
+    std::array<Suit, 4> suits;
+    for(unsigned s = 0; s < 4; ++s) {
+        auto& suit = suits[s];
+        uint64_t radix = 1;
+        unsigned used = 0;
+        for(unsigned r = 0; r < hand.size(); ++r) {
+            unsigned set = (hand[r].mask() >> (s * Hand::suitBits)) & Hand::suitMask;
+            uint64_t colex = 0;
+            for(unsigned bit = 0, position = 0, k = 0; bit < 13; ++bit) {      // rank of set among the free ranks
+                if(used & (1u << bit)) continue;
+                if(set & (1u << bit)) colex += Combinations::binomial(position, ++k);
+                ++position;
+            }
+            suit.sets[r] = set;
+            suit.sizes[r] = uint8_t(std::popcount(set));
+            suit.index += colex * radix;
+            radix *= Combinations::binomial(13 - std::popcount(used), suit.sizes[r]);
+            used |= set;
+        }
+    }
+    std::sort(suits.begin(), suits.end(), std::greater<Suit>());
+    return suits;
+}
+
+inline HandIndexer::Suit HandIndexer::suitAt(const Sizes& sizes, uint64_t index) const
+{
+    Suit suit;
+    suit.sizes = sizes;
+    suit.index = index;
+    unsigned used = 0;
+    for(unsigned r = 0; r < m_rounds.size(); ++r) {
+        unsigned free = 13 - std::popcount(used), k = sizes[r];
+        auto options = Combinations::binomial(free, k);
+        auto colex = index % options;
+        index /= options;
+        unsigned positions = 0;
+        for(unsigned j = k; j > 0; --j) {
+            unsigned position = j - 1;
+            while(Combinations::binomial(position + 1, j) <= colex) ++position;
+            colex -= Combinations::binomial(position, j);
+            positions |= 1u << position;
+        }
+        unsigned set = 0;
+        for(unsigned bit = 0, position = 0; bit < 13; ++bit) {
+            if(used & (1u << bit)) continue;
+            if(positions & (1u << position++)) set |= 1u << bit;
+        }
+        suit.sets[r] = set;
+        used |= set;
+    }
+    return suit;
+}
+
+inline uint64_t HandIndexer::index(const std::vector<Hand>& hand) const
+{
+    auto suits = split(hand);
+    std::array<Sizes, 4> sizes;
+    for(unsigned s = 0; s < 4; ++s) {
+        sizes[s] = suits[s].sizes;
+    }
+    auto& config = m_configs[std::lower_bound(m_keys.begin(), m_keys.end(), key(sizes)) - m_keys.begin()];
+
+    // groups in mixed radix; inside one, the descending suit indices x[0] >= x[1] ...
+    // become the strictly descending x[t] + m - 1 - t, ranked as a colex combination
+    uint64_t result = 0, radix = 1;
+    forGroups(sizes, [&](unsigned first, unsigned m, uint64_t n) {
+        uint64_t group = 0;
+        for(unsigned t = 0; t < m; ++t) {
+            group += Combinations::binomial(suits[first + t].index + m - 1 - t, m - t);
+        }
+        result += group * radix;
+        radix *= Combinations::binomial(n + m - 1, m);
+    });
+    return config.offset + result;
+}
+
+inline std::vector<Hand> HandIndexer::unindex(uint64_t index) const
+{
+    if(index >= m_size) {
+        throw std::out_of_range("hand index " + std::to_string(index));
+    }
+    auto config = std::upper_bound(m_configs.begin(), m_configs.end(), index,
+                                   [](uint64_t i, const Config& c) { return i < c.offset; }) - 1;
+    index -= config->offset;
+
+    std::array<Suit, 4> suits;
+    forGroups(config->sizes, [&](unsigned first, unsigned m, uint64_t n) {
+        auto options = Combinations::binomial(n + m - 1, m);
+        auto group = index % options;
+        index /= options;
+        for(unsigned t = 0; t < m; ++t) {
+            uint64_t low = m - t - 1, high = n + m - 1 - t;         // largest y with binomial(y, m - t) <= group
+            while(low + 1 < high) {
+                auto middle = (low + high) / 2;
+                (Combinations::binomial(middle, m - t) <= group ? low : high) = middle;
+            }
+            group -= Combinations::binomial(low, m - t);
+            suits[first + t] = suitAt(config->sizes[first + t], low - (m - 1 - t));
+        }
+    });
+
+    return join(suits);
+}
+
+inline std::vector<Hand> HandIndexer::canonical(const std::vector<Hand>& hand) const
+{
+    return join(split(hand));
+}
+
+inline std::vector<Hand> HandIndexer::join(const std::array<Suit, 4>& suits) const
+{
+    std::vector<Hand> hand(m_rounds.size());
+    for(unsigned r = 0; r < m_rounds.size(); ++r) {
+        uint64_t mask = 0;
+        for(unsigned s = 0; s < 4; ++s) {
+            mask |= uint64_t(suits[s].sets[r]) << (s * Hand::suitBits);
+        }
+        hand[r] = Hand(mask);
+    }
+    return hand;
+}
+
+inline unsigned HandIndexer::multiplicity(const std::vector<Hand>& hand) const
+{
+    auto suits = split(hand);
+    unsigned result = 24;
+    for(unsigned first = 0, last; first < 4; first = last) {
+        for(last = first + 1; last < 4 && suits[last].sizes == suits[first].sizes && suits[last].index == suits[first].index; ++last);
+        for(unsigned n = 2; n <= last - first; ++n) result /= n;
+    }
+    return result;
+}
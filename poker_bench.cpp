@@ -0,0 +1,596 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <stdexcept>
+#include <bit>
+
+#include "poker.hpp"
+
+// Micro-benchmarks for the ranking, deck and equity paths, plus a correctness
+// corpus: all 2,598,960 five-card hands and a sample of seven-card hands are ranked
+// by a slow reference and compared against every fast path, the single-hand ones and
+// the batch ones under each kernel the CPU supports.
+
+struct BenchConfig
+{
+    unsigned threads    = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t hands      = 1 << 24;  // hands per timing pass
+    unsigned passes     = 3;        // best of
+    uint64_t decks      = 1 << 21;  // shuffles per timing pass
+    uint64_t trials     = 1 << 21;  // Monte Carlo trials per scaling step
+    uint64_t sevens     = 1 << 21;  // seven-card hands sampled into the corpus
+    uint64_t seed       = 1;
+    bool corpus         = true;
+    std::string kernel;             // batch kernel to time, empty for every supported one
+    std::string output  = "poker_bench_result.json";
+};
+
+struct BenchResults
+{
+    struct Timing
+    {
+        std::string name;
+        uint64_t items;
+        double nanoseconds;     // per item, best pass
+    };
+    struct Scaling
+    {
+        unsigned threads;
+        double seconds;
+    };
+
+    std::vector<Timing> timings;
+    std::vector<Scaling> runs;          // EquitySimulator::run, AhAs vs KcKd
+    std::vector<Scaling> enumerations;  // EquitySimulator::enumerate, same hands
+    uint64_t checked = 0;
+    uint64_t errors = 0;
+};
+
+using Five = std::array<Card, 5>;
+using Seven = std::array<Card, 7>;
+
+static void benchRanking(const BenchConfig& config, BenchResults& results);
+static void benchDeck(const BenchConfig& config, BenchResults& results);
+static void benchScaling(const BenchConfig& config, BenchResults& results);
+static void checkCorpus(const BenchConfig& config, BenchResults& results);
+static void checkInvalidCards(BenchResults& results);
+
+static void parseArguments(int argc, char** argv, BenchConfig& config);
+static void writeResult(const BenchConfig& config, const BenchResults& results);
+
+int main(int argc, char** argv)
+{
+    using std::cout;
+    using std::endl;
+
+    BenchConfig config;
+    parseArguments(argc, argv, config);
+
+    cout << "Benchmarking poker paths: " << HandEvaluator::kernel() << " kernel, up to "
+         << config.threads << " threads, best of " << config.passes << endl;
+
+    BenchResults results;
+
+    if(config.corpus) checkCorpus(config, results);
+    checkInvalidCards(results);
+    benchRanking(config, results);
+    benchDeck(config, results);
+    benchScaling(config, results);
+
+    writeResult(config, results);
+
+    return results.errors ? 1 : 0;
+}
+
+
+/////////////////////////// benchmarks //////////////////////////////
+static volatile uint64_t g_sink;    // keeps timed results alive
+
+// Best of config.passes runs of work(), which handles items and returns a checksum.
+template <class F>
+static void measure(const BenchConfig& config, BenchResults& results, const std::string& name, uint64_t items, F&& work)
+{
+    double best = 0;
+    for(unsigned pass = 0; pass < config.passes; ++pass) {
+        auto start = std::chrono::steady_clock::now();
+        g_sink = g_sink + work();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        if(pass == 0 || elapsed.count() < best) best = elapsed.count();
+    }
+    results.timings.push_back({ name, items, best / items });
+    std::cout << "  " << std::left << std::setw(34) << name << std::right << std::setw(10)
+              << std::fixed << std::setprecision(2) << best / items << " ns" << std::endl;
+}
+
+template <size_t N>
+static std::vector<std::array<Card, N>> randomHands(size_t count, Random& random)
+{
+    std::vector<std::array<Card, N>> hands(count);
+    for(auto& hand: hands) {
+        auto deck = Deck::standard();
+        deck.shuffle(random, N);
+        for(auto& card: hand) card = deck.deal();
+    }
+    return hands;
+}
+
+static void benchRanking(const BenchConfig& config, BenchResults& results)
+{
+    std::cout << "ranking (ns/hand)" << std::endl;
+
+    // A working set that stays in cache, cycled until config.hands are done
+    constexpr size_t setSize = 1 << 16;
+    Random random(config.seed);
+    auto fives = randomHands<5>(setSize, random);
+    auto sevens = randomHands<7>(setSize, random);
+
+    std::vector<Hand> fiveHands, sevenHands;
+    HandBatch fiveBatch(setSize), sevenBatch(setSize);
+    for(auto& cards: fives) { fiveHands.emplace_back(cards); fiveBatch.push(fiveHands.back()); }
+    for(auto& cards: sevens) { sevenHands.emplace_back(cards); sevenBatch.push(sevenHands.back()); }
+
+    auto rounds = std::max<uint64_t>(1, config.hands / setSize);
+    auto items = rounds * setSize;
+
+    auto each = [&](const auto& set, auto&& f) {
+        uint64_t sum = 0;
+        for(uint64_t round = 0; round < rounds; ++round) {
+            for(auto& hand: set) sum += f(hand);
+        }
+        return sum;
+    };
+
+    measure(config, results, "flush, Deck::isFlush(cards)", items, [&] {
+        return each(fives, [](const Five& c) { return Deck::isFlush({ c[0], c[1], c[2], c[3], c[4] }); });
+    });
+    measure(config, results, "flush, Hand::isFlush()", items, [&] {
+        return each(fiveHands, [](const Hand& hand) { return hand.isFlush(); });
+    });
+    measure(config, results, "straight, Deck::isStraight(cards)", items, [&] {
+        return each(fives, [](const Five& cards) { return Deck::isStraight(cards); });
+    });
+    measure(config, results, "straight, Hand::isStraight()", items, [&] {
+        return each(fiveHands, [](const Hand& hand) { return hand.isStraight(); });
+    });
+    measure(config, results, "rank 5 cards, evaluate(hand)", items, [&] {
+        return each(fiveHands, [](const Hand& hand) { return HandEvaluator::evaluate(hand); });
+    });
+    measure(config, results, "rank 7 cards, evaluate(hand)", items, [&] {
+        return each(sevenHands, [](const Hand& hand) { return HandEvaluator::evaluate(hand); });
+    });
+
+    std::vector<uint8_t> flags(setSize);
+    std::vector<uint32_t> strengths(setSize);
+    auto batched = [&](auto&& f) {
+        uint64_t sum = 0;
+        for(uint64_t round = 0; round < rounds; ++round) {
+            f();
+            sum += flags[round % setSize] + strengths[round % setSize];
+        }
+        return sum;
+    };
+    auto kernels = config.kernel.empty() ? HandEvaluator::kernels() : std::vector<std::string>{ config.kernel };
+
+    for(auto& kernel: kernels) {
+        HandEvaluator::setKernel(kernel);
+        measure(config, results, "classify 5 cards, batch " + kernel, items, [&] {
+            return batched([&] { HandEvaluator::classify(fiveBatch, flags.data()); });
+        });
+        measure(config, results, "rank 5 cards, batch " + kernel, items, [&] {
+            return batched([&] { HandEvaluator::evaluate(fiveBatch, strengths.data()); });
+        });
+        measure(config, results, "rank 7 cards, batch " + kernel, items, [&] {
+            return batched([&] { HandEvaluator::evaluate(sevenBatch, strengths.data()); });
+        });
+    }
+    HandEvaluator::setKernel(kernels.front());
+}
+
+static void benchDeck(const BenchConfig& config, BenchResults& results)
+{
+    std::cout << "deck (ns/deck)" << std::endl;
+
+    Random random(config.seed);
+
+    // Full Fisher-Yates then dealing every card, and the partial shuffle a heads-up
+    // simulation does: two holes and a board off the top
+    for(unsigned cards: { Deck::capacity, 9u }) {
+        auto name = cards == Deck::capacity ? std::string("shuffle + deal 52") : "partial shuffle + deal " + std::to_string(cards);
+        measure(config, results, name, config.decks, [&] {
+            uint64_t sum = 0;
+            for(uint64_t i = 0; i < config.decks; ++i) {
+                auto deck = Deck::standard();
+                deck.shuffle(random, cards);
+                for(unsigned n = 0; n < cards; ++n) sum += deck.deal().code();
+            }
+            return sum;
+        });
+    }
+    measure(config, results, "Deck::shuffle() thread_local", config.decks, [&] {
+        uint64_t sum = 0;
+        auto deck = Deck::standard();
+        for(uint64_t i = 0; i < config.decks; ++i) {
+            deck.shuffle();
+            sum += deck.at(0).code();
+        }
+        return sum;
+    });
+}
+
+static void benchScaling(const BenchConfig& config, BenchResults& results)
+{
+    using std::cout;
+    using std::endl;
+
+    cout << "scaling, AhAs vs KcKd" << endl;
+
+    EquitySimulator simulator({ Hand({ { Card::SUIT::HEART, Card::RANK::A }, { Card::SUIT::SPADE, Card::RANK::A } }),
+                                Hand({ { Card::SUIT::CLUB, Card::RANK::K }, { Card::SUIT::DIAMOND, Card::RANK::K } }) },
+                              Hand(uint64_t(0)));
+
+    std::vector<unsigned> threadCounts;
+    for(unsigned threads = 1; threads < config.threads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(config.threads);
+
+    // Results are fixed by the seed whatever the thread count, so any drift is a bug
+    auto time = [&](std::vector<BenchResults::Scaling>& scaling, const std::string& name, auto&& solve) {
+        std::vector<EquitySimulator::Player> first;
+        for(auto threads: threadCounts) {
+            auto start = std::chrono::steady_clock::now();
+            auto players = solve(threads);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            if(first.empty()) first = players;
+            if(players[0].wins != first[0].wins || players[0].ties != first[0].ties) {
+                cout << "  " << name << " differs at " << threads << " threads" << endl;
+                results.errors++;
+            }
+            scaling.push_back({ threads, elapsed.count() });
+            cout << "  " << std::left << std::setw(10) << name << std::right << std::setw(3) << threads
+                 << " threads " << std::setw(10) << std::setprecision(3) << elapsed.count() << " s, speedup "
+                 << std::setprecision(2) << scaling.front().seconds / elapsed.count() << endl;
+        }
+    };
+
+    time(results.runs, "run", [&](unsigned threads) { return simulator.run(config.trials, config.seed, threads); });
+    time(results.enumerations, "enumerate", [&](unsigned threads) { return simulator.enumerate(threads); });
+}
+
+
+/////////////////////////// corpus //////////////////////////////
+// The references work from the cards one at a time, sharing nothing with Hand or
+// the evaluator tables. Values are 2..14 with the ace high, as in the strengths.
+static unsigned referenceValue(const Card& card)
+{
+    return card.rank() == Card::RANK::A ? 14 : unsigned(card.rank());
+}
+
+static bool referenceFlush(const Five& cards)
+{
+    return std::all_of(cards.begin(), cards.end(), [&](const Card& card) { return card.suit() == cards[0].suit(); });
+}
+
+// Top value of a five-card straight, 0 if none. The ace plays low in A-2-3-4-5
+// only, K-A-2 does not wrap.
+static unsigned referenceStraight(const Five& cards)
+{
+    std::array<unsigned, 5> values;
+    std::transform(cards.begin(), cards.end(), values.begin(), referenceValue);
+    std::sort(values.begin(), values.end());
+    if(std::adjacent_find(values.begin(), values.end()) != values.end()) return 0;
+    if(values[4] - values[0] == 4) return values[4];
+    return values == std::array<unsigned, 5>{ 2, 3, 4, 5, 14 } ? 5 : 0;
+}
+
+static uint32_t referenceStrength(const Five& cards)
+{
+    // (count, value) groups, biggest group first, then highest value
+    std::vector<std::pair<unsigned, unsigned>> groups;
+    for(auto& card: cards) {
+        auto value = referenceValue(card);
+        auto group = std::find_if(groups.begin(), groups.end(), [&](auto& g) { return g.second == value; });
+        if(group == groups.end()) groups.push_back({ 1, value });
+        else group->first++;
+    }
+    std::sort(groups.rbegin(), groups.rend());
+
+    using CATEGORY = HandEvaluator::CATEGORY;
+    CATEGORY category;
+    auto flush = referenceFlush(cards);
+    auto straight = referenceStraight(cards);
+
+    if(straight && flush) category = CATEGORY::STRAIGHT_FLUSH;
+    else if(groups[0].first == 4) category = CATEGORY::QUADS;
+    else if(groups[0].first == 3 && groups[1].first == 2) category = CATEGORY::FULL_HOUSE;
+    else if(flush) category = CATEGORY::FLUSH;
+    else if(straight) category = CATEGORY::STRAIGHT;
+    else if(groups[0].first == 3) category = CATEGORY::TRIPS;
+    else if(groups[0].first == 2 && groups[1].first == 2) category = CATEGORY::TWO_PAIR;
+    else if(groups[0].first == 2) category = CATEGORY::PAIR;
+    else category = CATEGORY::HIGH_CARD;
+
+    uint32_t result = uint32_t(category);
+    unsigned n = 0;
+    if(straight) {
+        result = (result << 4) | straight;
+        n = 1;
+    }
+    else {
+        for(auto& group: groups) { result = (result << 4) | group.second; ++n; }
+    }
+    for(; n < 5; ++n) result <<= 4;
+    return result;
+}
+
+static uint32_t referenceStrength(const Seven& cards)
+{
+    uint32_t best = 0;
+    for(unsigned skip1 = 0; skip1 < 7; ++skip1) {
+        for(unsigned skip2 = skip1 + 1; skip2 < 7; ++skip2) {
+            Five five;
+            unsigned n = 0;
+            for(unsigned i = 0; i < 7; ++i) {
+                if(i != skip1 && i != skip2) five[n++] = cards[i];
+            }
+            best = std::max(best, referenceStrength(five));
+        }
+    }
+    return best;
+}
+
+template <size_t N>
+static void reportMismatch(BenchResults& results, const std::array<Card, N>& cards, const std::string& path,
+                           uint32_t got, uint32_t expected)
+{
+    if(results.errors++ < 10) {
+        std::cout << "  mismatch in " << path << " for";
+        for(auto& card: cards) std::cout << " " << card;
+        std::cout << ": " << std::hex << got << " expected " << expected << std::dec << std::endl;
+    }
+}
+
+static void checkCorpus(const BenchConfig& config, BenchResults& results)
+{
+    using std::cout;
+    using std::endl;
+
+    cout << "corpus" << endl;
+    auto errors = results.errors;
+
+    std::vector<Five> fives;
+    std::vector<uint32_t> expected;
+    HandBatch batch(2598960);
+    fives.reserve(2598960);
+    expected.reserve(2598960);
+
+    std::array<uint64_t, 9> categories = {};
+    for(uint8_t a = 0; a < 52; ++a)
+    for(uint8_t b = a + 1; b < 52; ++b)
+    for(uint8_t c = b + 1; c < 52; ++c)
+    for(uint8_t d = c + 1; d < 52; ++d)
+    for(uint8_t e = d + 1; e < 52; ++e) {
+        Five cards = { Card::fromCode(a), Card::fromCode(b), Card::fromCode(c), Card::fromCode(d), Card::fromCode(e) };
+        Hand hand(cards);
+        auto strength = referenceStrength(cards);
+        bool flush = referenceFlush(cards), straight = referenceStraight(cards);
+
+        if(Deck::isFlush({ cards[0], cards[1], cards[2], cards[3], cards[4] }) != flush)
+            reportMismatch(results, cards, "Deck::isFlush", !flush, flush);
+        if(hand.isFlush() != flush) reportMismatch(results, cards, "Hand::isFlush", !flush, flush);
+        if(Deck::isStraight(cards) != straight) reportMismatch(results, cards, "Deck::isStraight", !straight, straight);
+        if(hand.isStraight() != straight) reportMismatch(results, cards, "Hand::isStraight", !straight, straight);
+        if(auto got = HandEvaluator::evaluate(hand); got != strength) {
+            reportMismatch(results, cards, "HandEvaluator::evaluate", got, strength);
+        }
+
+        categories[unsigned(HandEvaluator::category(strength))]++;
+        fives.push_back(cards);
+        expected.push_back(strength);
+        batch.push(hand);
+    }
+
+    // Every batch kernel over the whole corpus, not only the one dispatch picks here
+    auto kernels = HandEvaluator::kernels();
+    std::vector<uint8_t> wanted(batch.size());
+    for(size_t i = 0; i < fives.size(); ++i) {
+        wanted[i] = (referenceFlush(fives[i]) ? HandEvaluator::FLUSH : 0)
+                  | (referenceStraight(fives[i]) ? HandEvaluator::STRAIGHT : 0);
+    }
+    std::vector<uint8_t> flags(batch.size());
+    std::vector<uint32_t> strengths(batch.size());
+    for(auto& kernel: kernels) {
+        HandEvaluator::setKernel(kernel);
+        HandEvaluator::classify(batch, flags.data());
+        HandEvaluator::evaluate(batch, strengths.data());
+        for(size_t i = 0; i < fives.size(); ++i) {
+            if(flags[i] != wanted[i]) reportMismatch(results, fives[i], "classify batch " + kernel, flags[i], wanted[i]);
+            if(strengths[i] != expected[i]) reportMismatch(results, fives[i], "evaluate batch " + kernel, strengths[i], expected[i]);
+        }
+    }
+
+    // The reference itself against the known counts per category and of distinct strengths
+    constexpr std::array<uint64_t, 9> known = { 1302540, 1098240, 123552, 54912, 10200, 5108, 3744, 624, 40 };
+    if(categories != known) {
+        cout << "  category counts differ from the known distribution" << endl;
+        results.errors++;
+    }
+    std::sort(expected.begin(), expected.end());
+    auto distinct = std::unique(expected.begin(), expected.end()) - expected.begin();
+    if(distinct != 7462) {
+        cout << "  " << distinct << " distinct strengths, expected 7462" << endl;
+        results.errors++;
+    }
+    results.checked += fives.size();
+
+    // Seven-card hands against the best of their 21 five-card subsets
+    Random random(config.seed);
+    auto sevens = randomHands<7>(config.sevens, random);
+    HandBatch sevenBatch(sevens.size());
+    std::vector<uint32_t> sevenExpected;
+    for(auto& cards: sevens) {
+        Hand hand(cards);
+        auto strength = referenceStrength(cards);
+        bool flush = std::any_of(cards.begin(), cards.end(), [&](const Card& card) {
+            return std::count_if(cards.begin(), cards.end(), [&](const Card& other) { return other == card; }) >= 5;
+        });
+        if(hand.isFlush() != flush) reportMismatch(results, cards, "Hand::isFlush", !flush, flush);
+        if(auto got = HandEvaluator::evaluate(hand); got != strength) {
+            reportMismatch(results, cards, "HandEvaluator::evaluate", got, strength);
+        }
+        sevenBatch.push(hand);
+        sevenExpected.push_back(strength);
+    }
+    strengths.resize(sevenBatch.size());
+    for(auto& kernel: kernels) {
+        HandEvaluator::setKernel(kernel);
+        HandEvaluator::evaluate(sevenBatch, strengths.data());
+        for(size_t i = 0; i < sevens.size(); ++i) {
+            if(strengths[i] != sevenExpected[i]) {
+                reportMismatch(results, sevens[i], "evaluate batch " + kernel, strengths[i], sevenExpected[i]);
+            }
+        }
+    }
+    HandEvaluator::setKernel(config.kernel.empty() ? kernels.front() : config.kernel);
+    results.checked += sevens.size();
+
+    cout << "  " << fives.size() << " five-card and " << sevens.size() << " seven-card hands, "
+         << results.errors - errors << " mismatches, batch kernels";
+    for(auto& kernel: kernels) cout << " " << kernel;
+    cout << endl;
+}
+
+// Codes past the 52 cards must not reach Deck's slot table or Hand's lanes: 52..239
+// would set bits in the unused lane tops, 240 and up would shift past 64 bits.
+static void checkInvalidCards(BenchResults& results)
+{
+    std::cout << "invalid cards" << std::endl;
+    auto errors = results.errors;
+
+    auto rejected = [&](const std::string& path, auto&& use) {
+        try {
+            use();
+        }
+        catch(const std::invalid_argument&) {
+            return;
+        }
+        std::cout << "  " << path << " accepted an invalid card" << std::endl;
+        results.errors++;
+    };
+
+    for(unsigned code: { 52u, 63u, 64u, 239u, 240u, 255u }) {
+        auto name = " code " + std::to_string(code);
+        rejected("Card::fromCode" + name, [&] { Card::fromCode(uint8_t(code)); });
+        rejected("Deck::add" + name, [&] { Deck deck; deck.add(Card::fromCode(uint8_t(code))); });
+        rejected("Hand +=" + name, [&] { Hand hand; hand += Card::fromCode(uint8_t(code)); });
+    }
+    rejected("Card suit 5", [] { Card(Card::SUIT(5), Card::RANK::A); });
+    rejected("Card rank 14", [] { Card(Card::SUIT::HEART, Card::RANK(14)); });
+    rejected("Card rank 0", [] { Card(Card::SUIT::HEART, Card::RANK(0)); });
+
+    // and the valid extremes still go through
+    Deck deck;
+    Hand hand;
+    for(uint8_t code: { uint8_t(0), uint8_t(51) }) {
+        deck.add(Card::fromCode(code));
+        hand += Card::fromCode(code);
+    }
+    if(deck.totalCards() != 2 || std::popcount(hand.mask()) != 2) {
+        std::cout << "  codes 0 and 51 not held" << std::endl;
+        results.errors++;
+    }
+
+    std::cout << "  " << results.errors - errors << " mismatches" << std::endl;
+}
+
+
+/////////////////////////// helpers //////////////////////////////
+static void parseArguments(int argc, char** argv, BenchConfig& config)
+{
+    for(int i = 1; i < argc; i++) {
+        std::string_view option = argv[i];
+
+        if(option == "--no-corpus") {
+            config.corpus = false;
+            continue;
+        }
+        if(option == "--help" || i + 1 >= argc) {
+            std::cout << "usage: " << argv[0] << " [--threads N] [--hands N] [--passes N] [--decks N]"
+                      << " [--trials N] [--sevens N] [--seed N] [--kernel NAME] [--no-corpus] [--output FILE]" << std::endl;
+            std::exit(option == "--help" ? 0 : 1);
+        }
+
+        std::string value = argv[++i];
+
+        if(option == "--threads")       config.threads = std::max(1ul, std::stoul(value));
+        else if(option == "--hands")    config.hands   = std::max(1ull, std::stoull(value));
+        else if(option == "--passes")   config.passes  = std::max(1ul, std::stoul(value));
+        else if(option == "--decks")    config.decks   = std::max(1ull, std::stoull(value));
+        else if(option == "--trials")   config.trials  = std::max(1ull, std::stoull(value));
+        else if(option == "--sevens")   config.sevens  = std::stoull(value);
+        else if(option == "--seed")     config.seed    = std::stoull(value);
+        else if(option == "--output")   config.output  = value;
+        else if(option == "--kernel") {
+            if(!HandEvaluator::setKernel(value)) {
+                std::cerr << "kernel " << value << " is not supported here, try:";
+                for(auto& kernel: HandEvaluator::kernels()) std::cerr << " " << kernel;
+                std::cerr << std::endl;
+                std::exit(1);
+            }
+            config.kernel = value;
+        }
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            std::exit(1);
+        }
+    }
+}
+
+static void writeResult(const BenchConfig& config, const BenchResults& results)
+{
+    std::cout << "errors:        " << results.errors << std::endl;
+
+    std::ofstream file(config.output);
+
+    auto scaling = [&](const std::vector<BenchResults::Scaling>& steps) {
+        file << "[\n";
+        for(size_t i = 0; i < steps.size(); ++i) {
+            file << "    { \"threads\": " << steps[i].threads
+                 << ", \"seconds\": " << steps[i].seconds
+                 << ", \"speedup\": " << steps.front().seconds / steps[i].seconds << " }"
+                 << (i + 1 < steps.size() ? ",\n" : "\n");
+        }
+        file << "  ]";
+    };
+
+    file << "{\n"
+         << "  \"kernel\": \"" << HandEvaluator::kernel() << "\",\n"
+         << "  \"threads\": " << config.threads << ",\n"
+         << "  \"passes\": " << config.passes << ",\n"
+         << "  \"seed\": " << config.seed << ",\n"
+         << "  \"ns_per_item\": {\n";
+    for(size_t i = 0; i < results.timings.size(); ++i) {
+        file << "    \"" << results.timings[i].name << "\": " << results.timings[i].nanoseconds
+             << (i + 1 < results.timings.size() ? ",\n" : "\n");
+    }
+    file << "  },\n"
+         << "  \"trials\": " << config.trials << ",\n"
+         << "  \"run_scaling\": ";
+    scaling(results.runs);
+    file << ",\n"
+         << "  \"enumerate_scaling\": ";
+    scaling(results.enumerations);
+    file << ",\n"
+         << "  \"corpus_hands\": " << results.checked << ",\n"
+         << "  \"errors\": " << results.errors << "\n"
+         << "}\n";
+
+    std::cout << "result written to " << config.output << std::endl;
+}
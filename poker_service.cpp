@@ -0,0 +1,490 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <bit>
+#include <signal.h>
+
+#include "event_listener.hpp"
+#include "poker.hpp"
+
+// Hand evaluation and equity over TCP. Every message is a length-prefixed
+// frame, and all integers inside are big-endian like the length:
+//
+//   request:   u32 id, u8 op, body
+//     EVALUATE   u16 count, count x u64 hand        (5 to 7 cards each)
+//     EQUITY     u32 trials (0 enumerates every board), u64 seed,
+//                u8 players, players x u64 hole, u64 board
+//   response:  u32 id, u8 status, body if the status is OK
+//     EVALUATE   u16 count, count x u32 strength    (HandEvaluator::evaluate)
+//     EQUITY     u8 players, players x ( u64 wins, u64 ties, u64 losses,
+//                u32 equity in billionths )
+//
+// A hand is a Hand mask, one bit per card at 16 * ( suit - 1 ) + rank - 1.
+// Requests may be pipelined. Responses carry the request id and can overtake
+// each other, so a quick evaluation never waits behind an equity run. A peer
+// that shuts down its side still gets the answers to what it has sent.
+
+struct ServiceConfig
+{
+    int port                = 3680;
+    unsigned threads        = 2;        // listener pool, only decodes requests
+    unsigned reactors       = 1;
+    unsigned computeThreads = std::max( 1u, std::thread::hardware_concurrency() );
+};
+
+// Evaluation runs on a compute pool of its own, so the listener's handlers
+// only decode and return. Evaluate requests from all connections are
+// coalesced into one open HandBatch. An idle compute thread takes the batch
+// as it is, otherwise it grows until batchHands or until a running batch
+// completes. Quiet traffic thus sees no added delay, and bursts of small
+// queries are evaluated batchHands at a time by the SIMD kernel. Every
+// accepted request holds its connection until the compute thread answers.
+class PokerService
+{
+public:
+    enum Op : uint8_t { EVALUATE = 1, EQUITY = 2 };
+    enum Status : uint8_t { OK = 0, BAD_REQUEST = 1 };
+
+    static constexpr std::size_t batchHands = 256;      // 32 rounds of the 8-lane AVX2 kernel
+    static constexpr std::size_t maxHands   = 4096;     // per evaluate request
+    static constexpr uint32_t maxTrials     = 1 << 20;
+    static constexpr uint64_t maxBoards     = 2000000;  // heads-up preflop enumerates 1712304
+
+    explicit PokerService( unsigned computeThreads );
+
+    // For onFrames: decodes the frames and queues the work
+    void handle( std::weak_ptr<EventWorker> eventWorker, const std::vector<std::string_view>& frames );
+
+    void dumpStats( std::ostream& os ) const;
+
+    PokerService( const PokerService& )            = delete;
+    PokerService& operator=( const PokerService& ) = delete;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint64_t cardBits = 0x1FFF1FFF1FFF1FFF;   // of a Hand mask
+
+    // An evaluate request whose hands sit in a batch
+    struct Pending
+    {
+        std::shared_ptr<EventWorker> eventWorker;   // held
+        uint32_t id;
+        uint32_t first;             // of its hands in the batch
+        uint32_t count;
+        Clock::time_point arrived;
+    };
+
+    struct Batch
+    {
+        HandBatch hands { batchHands };
+        std::vector<Pending> requests;
+        std::vector<uint32_t> strengths;
+    };
+
+    bool evaluate( const std::shared_ptr<EventWorker>& eventWorker, uint32_t id, std::string_view body, Clock::time_point arrived );
+    bool equity( const std::shared_ptr<EventWorker>& eventWorker, uint32_t id, std::string_view body, Clock::time_point arrived );
+    void dispatch();    // with m_mutex held
+    void run( std::shared_ptr<Batch> batch );
+    void reply( std::shared_ptr<EventWorker> eventWorker, std::string_view response,
+                Clock::time_point arrived, LatencyHistogram& latency );
+    void reject( EventWorker& eventWorker, uint32_t id );
+
+    std::mutex m_mutex;                         // guards the batches and m_running
+    std::shared_ptr<Batch> m_open;
+    std::vector< std::shared_ptr<Batch> > m_spare;
+    unsigned m_running = 0;                     // batches queued or running on the pool
+
+    std::atomic<uint64_t> m_requests { 0 };
+    std::atomic<uint64_t> m_rejected { 0 };
+    std::atomic<uint64_t> m_hands { 0 };
+    std::atomic<uint64_t> m_batches { 0 };
+
+    LatencyHistogram m_evaluateLatency;         // nanoseconds, decoded -> response queued
+    LatencyHistogram m_equityLatency;
+    LatencyHistogram m_batchDelay;              // nanoseconds, decoded -> its batch starts
+    LatencyHistogram m_batchSizes;              // hands per batch
+
+    // Last, so that it is joined while the jobs can still use the rest
+    ThreadPool m_computePool;
+};
+
+static bool take( std::string_view& data, unsigned numBytes, uint64_t& value );
+static void put( std::string& data, unsigned numBytes, uint64_t value );
+
+static void parseArguments( int argc, char** argv, ServiceConfig& config );
+
+static EventListener eventListener;
+static std::atomic<bool> statsRequested { false };
+
+void handleExitSignal( int ) {
+    eventListener.close();
+}
+
+void handleStatsSignal( int ) {
+    statsRequested = true;
+    eventListener.requestStatsDump();
+}
+
+int main( int argc, char** argv )
+{
+    using std::cout;
+    using std::endl;
+
+    ServiceConfig config;
+    parseArguments( argc, argv, config );
+
+    cout << endl;
+    cout << "Poker service started on port: " << config.port << endl;
+    cout << "Evaluating on " << config.computeThreads << " threads, " << HandEvaluator::kernel() << " kernel" << endl;
+    cout << "Send SIGUSR1 for statistics" << endl;
+
+    signal( SIGINT, handleExitSignal );
+    signal( SIGTERM, handleExitSignal );
+    signal( SIGUSR1, handleStatsSignal );
+
+    PokerService service( config.computeThreads );
+
+    // Build the evaluator's tables now rather than in the first request
+    HandEvaluator::evaluate( HandBatch(), nullptr );
+
+    eventListener.setPort( config.port );
+    eventListener.setThreadCount( config.threads );
+    eventListener.setReactorCount( config.reactors );
+    eventListener.setFraming( EventListener::Framing::LengthPrefixed, 64 << 10 );
+
+    eventListener.onFrames( [&service] ( std::weak_ptr<EventWorker> eventWorker,
+                                         const std::vector<std::string_view>& frames )
+    {
+        // The listener prints its own stats on the signal, ours come with the next request
+        if( statsRequested.exchange( false ) )
+            service.dumpStats( std::cout );
+
+        service.handle( std::move( eventWorker ), frames );
+    } );
+
+    eventListener.listen();
+    service.dumpStats( cout );
+
+    return 0;
+}
+
+
+/////////////////////////// PokerService class //////////////////////////////
+PokerService::PokerService( unsigned computeThreads )
+    : m_computePool( std::max( 1u, computeThreads ) )
+{
+}
+
+void PokerService::handle( std::weak_ptr<EventWorker> eventWorker, const std::vector<std::string_view>& frames )
+{
+    auto ew = eventWorker.lock();
+
+    if( !ew )
+        return;
+
+    auto arrived = Clock::now();
+    bool queued  = false;
+
+    for( auto&& frame : frames )
+    {
+        std::string_view data = frame;
+        uint64_t id = 0, op = 0;
+
+        m_requests++;
+
+        if( !take( data, 4, id ) || !take( data, 1, op ) )
+            reject( *ew, uint32_t( id ) );
+        else if( op == EVALUATE )
+            queued |= evaluate( ew, uint32_t( id ), data, arrived );
+        else if( op != EQUITY || !equity( ew, uint32_t( id ), data, arrived ) )
+            reject( *ew, uint32_t( id ) );
+    }
+
+    // A whole burst of frames is queued before an idle thread takes the batch
+    if( queued )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        if( m_running < m_computePool.size() )
+            dispatch();
+    }
+}
+
+bool PokerService::evaluate( const std::shared_ptr<EventWorker>& eventWorker, uint32_t id, std::string_view body,
+                             Clock::time_point arrived )
+{
+    uint64_t count = 0;
+
+    if( !take( body, 2, count ) || count == 0 || count > maxHands || body.size() != count * 8 )
+    {
+        reject( *eventWorker, id );
+        return false;
+    }
+
+    for( std::string_view hands = body; !hands.empty(); )
+    {
+        uint64_t mask = 0;
+        take( hands, 8, mask );
+
+        if( ( mask & ~cardBits ) || std::popcount( mask ) < 5 || std::popcount( mask ) > 7 )
+        {
+            reject( *eventWorker, id );
+            return false;
+        }
+    }
+
+    eventWorker->hold();
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    if( !m_open )
+    {
+        if( m_spare.empty() )
+            m_open = std::make_shared<Batch>();
+        else
+        {
+            m_open = std::move( m_spare.back() );
+            m_spare.pop_back();
+        }
+    }
+
+    m_open->requests.push_back( { eventWorker, id, uint32_t( m_open->hands.size() ), uint32_t( count ), arrived } );
+
+    for( uint64_t mask = 0; !body.empty(); )
+    {
+        take( body, 8, mask );
+        m_open->hands.push( Hand( mask ) );
+    }
+
+    m_hands += count;
+
+    if( m_open->hands.size() >= batchHands )
+        dispatch();
+
+    return true;
+}
+
+bool PokerService::equity( const std::shared_ptr<EventWorker>& eventWorker, uint32_t id, std::string_view body,
+                           Clock::time_point arrived )
+{
+    uint64_t trials = 0, seed = 0, numPlayers = 0, board = 0;
+
+    if( !take( body, 4, trials ) || !take( body, 8, seed ) || !take( body, 1, numPlayers ) ||
+        trials > maxTrials || body.size() != ( numPlayers + 1 ) * 8 )
+        return false;
+
+    // Card counts and overlaps are left to the simulator's own checks
+    std::vector<Hand> holes;
+
+    for( uint64_t mask = 0; holes.size() < numPlayers; )
+    {
+        take( body, 8, mask );
+        holes.emplace_back( mask );
+
+        if( mask & ~cardBits )
+            return false;
+    }
+
+    take( body, 8, board );
+
+    if( board & ~cardBits )
+        return false;
+
+    eventWorker->hold();
+
+    m_computePool.enqueue( [this, eventWorker, id, trials, seed, holes = std::move( holes ), board, arrived] () mutable
+    {
+        std::string response;
+        put( response, 4, id );
+
+        try
+        {
+            EquitySimulator simulator( holes, Hand( board ) );
+
+            if( trials == 0 && simulator.boards() > maxBoards )
+                throw std::runtime_error( "too many boards to enumerate" );
+
+            // One thread each, the pool runs many requests side by side
+            auto players = trials ? simulator.run( trials, seed, 1 ) : simulator.enumerate( 1 );
+
+            put( response, 1, OK );
+            put( response, 1, players.size() );
+
+            for( auto&& player : players )
+            {
+                put( response, 8, player.wins );
+                put( response, 8, player.ties );
+                put( response, 8, player.losses );
+                put( response, 4, uint64_t( player.equity * 1e9 + 0.5 ) );
+            }
+        }
+        catch( const std::exception& )
+        {
+            m_rejected++;
+            response.resize( 4 );
+            put( response, 1, BAD_REQUEST );
+        }
+
+        reply( std::move( eventWorker ), response, arrived, m_equityLatency );
+    } );
+
+    return true;
+}
+
+void PokerService::dispatch()
+{
+    if( !m_open || m_open->requests.empty() )
+        return;
+
+    m_running++;
+    m_batches++;
+    m_computePool.enqueue( [this, batch = std::move( m_open )] { run( batch ); } );
+}
+
+void PokerService::run( std::shared_ptr<Batch> batch )
+{
+    auto started = Clock::now();
+
+    batch->strengths.resize( batch->hands.size() );
+    HandEvaluator::evaluate( batch->hands, batch->strengths.data() );
+
+    m_batchSizes.record( batch->hands.size() );
+
+    std::string response;
+
+    for( auto&& request : batch->requests )
+    {
+        m_batchDelay.record( std::chrono::duration_cast<std::chrono::nanoseconds>( started - request.arrived ).count() );
+
+        response.clear();
+        put( response, 4, request.id );
+        put( response, 1, OK );
+        put( response, 2, request.count );
+
+        for( uint32_t i = 0; i < request.count; i++ )
+            put( response, 4, batch->strengths[request.first + i] );
+
+        reply( std::move( request.eventWorker ), response, request.arrived, m_evaluateLatency );
+    }
+
+    batch->hands.clear();
+    batch->requests.clear();
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_running--;
+    m_spare.push_back( std::move( batch ) );
+
+    // What came in meanwhile goes now, however small
+    dispatch();
+}
+
+void PokerService::reply( std::shared_ptr<EventWorker> eventWorker, std::string_view response,
+                          Clock::time_point arrived, LatencyHistogram& latency )
+{
+    // Writes from outside a handler go out right away
+    eventWorker->writeFrame( response );
+
+    latency.record( std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - arrived ).count() );
+
+    // The last use of the worker
+    EventWorker::release( std::move( eventWorker ) );
+}
+
+void PokerService::reject( EventWorker& eventWorker, uint32_t id )
+{
+    std::string response;
+    put( response, 4, id );
+    put( response, 1, BAD_REQUEST );
+
+    m_rejected++;
+
+    eventWorker.writeFrame( response );
+}
+
+void PokerService::dumpStats( std::ostream& os ) const
+{
+    auto printLatency = [&os] ( const char* name, const LatencyHistogram& histogram )
+    {
+        os << "  " << name << " (us): count " << histogram.count()
+           << ", mean " << histogram.mean() / 1000.0
+           << ", p50 " << histogram.percentile( 0.5 ) / 1000.0
+           << ", p99 " << histogram.percentile( 0.99 ) / 1000.0
+           << ", p999 " << histogram.percentile( 0.999 ) / 1000.0
+           << ", max " << histogram.max() / 1000.0 << std::endl;
+    };
+
+    os << "PokerService stats (" << m_computePool.size() << " compute threads, "
+       << HandEvaluator::kernel() << " kernel)" << std::endl;
+    os << "  requests: " << m_requests << ", rejected " << m_rejected
+       << ", pending jobs " << m_computePool.pendingJobs() << std::endl;
+    os << "  batches: " << m_batches << ", hands " << m_hands
+       << ", hands per batch mean " << m_batchSizes.mean()
+       << ", p50 " << m_batchSizes.percentile( 0.5 )
+       << ", max " << m_batchSizes.max() << std::endl;
+
+    printLatency( "evaluate", m_evaluateLatency );
+    printLatency( "batch delay", m_batchDelay );
+    printLatency( "equity", m_equityLatency );
+}
+
+
+/////////////////////////// helpers //////////////////////////////
+// Big-endian integers of 1 to 8 bytes; take() fails without consuming
+// anything when the data is too short
+static bool take( std::string_view& data, unsigned numBytes, uint64_t& value )
+{
+    if( data.size() < numBytes )
+        return false;
+
+    value = 0;
+
+    for( unsigned i = 0; i < numBytes; i++ )
+        value = ( value << 8 ) | static_cast<unsigned char>( data[i] );
+
+    data.remove_prefix( numBytes );
+    return true;
+}
+
+static void put( std::string& data, unsigned numBytes, uint64_t value )
+{
+    for( unsigned i = numBytes; i-- > 0; )
+        data.push_back( static_cast<char>( value >> ( i * 8 ) ) );
+}
+
+static void parseArguments( int argc, char** argv, ServiceConfig& config )
+{
+    for( int i = 1; i < argc; i++ )
+    {
+        std::string_view option = argv[i];
+
+        if( option == "--help" || i + 1 >= argc )
+        {
+            std::cout << "usage: " << argv[0] << " [--port PORT] [--threads N] [--reactors N]"
+                      << " [--compute-threads N]" << std::endl;
+            std::exit( option == "--help" ? 0 : 1 );
+        }
+
+        std::string value = argv[++i];
+
+        if( option == "--port" )                 config.port           = std::stoi( value );
+        else if( option == "--threads" )         config.threads        = std::max( 1ul, std::stoul( value ) );
+        else if( option == "--reactors" )        config.reactors       = std::max( 1ul, std::stoul( value ) );
+        else if( option == "--compute-threads" ) config.computeThreads = std::max( 1ul, std::stoul( value ) );
+        else
+        {
+            std::cerr << "unknown option " << option << std::endl;
+            std::exit( 1 );
+        }
+    }
+}
@@ -1,51 +1,8 @@
 #include <iostream>
 #include <vector>
-#include <array>
-#include <random>
-#include <algorithm>
 #include <string>
 
-class Card
-{
-public:
-    enum class SUIT { HEART = 1, DIAMOND, CLUB, SPADE };
-    enum class RANK { A = 1, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE, TEN, J, Q, K };
-
-    Card(SUIT suit, RANK rank) : m_suit(suit), m_rank(rank) { }
-
-    SUIT suit() const { return m_suit; }
-    RANK rank() const { return m_rank; }
-
-    // operator overloads
-    friend bool operator < (const Card& lhs, const Card& rhs);  // lhs.rank < rhs.rank
-    friend bool operator > (const Card& lhs, const Card& rhs);  // lhs.rank > rhs.rank
-    friend bool operator == (const Card& lhs, const Card& rhs); // lhs.suit == rhs.suit
-    friend bool operator != (const Card& lhs, const Card& rhs); // lhs.suit != rhs.suit
-    friend std::ostream& operator << (std::ostream& os, const Card& card);
-
-private:
-    SUIT m_suit;
-    RANK m_rank;
-};
-
-
-using CardList = std::initializer_list<Card>;
-using CardArray_5 = const std::array<Card, 5>;
-class Deck
-{
-public:
-    Deck(CardList cards) : m_cards(cards) {}
-
-    unsigned totalCards() const { return m_cards.size(); }      // total number of cards in the deck
-    const Card& at(unsigned i) const { return m_cards.at(i); }  // access card by given index
-    void shuffle() { std::random_shuffle(m_cards.begin(), m_cards.end()); }  // randomize all the cards in a deck
-
-    static bool isFlush(CardList cards);                // if all cards have the same suit
-    static bool isStraight(CardArray_5  &cards);  // if all 5 cards have consecutive ranks
-
-private:
-    std::vector<Card> m_cards;
-};
+#include "poker.hpp"
 
 
 int main()
@@ -69,63 +26,7 @@ int main()
 
     cout << endl;
 
-    Deck standartDeck = {
-        { Card::SUIT::HEART, Card::RANK::A },
-        { Card::SUIT::HEART, Card::RANK::TWO },
-        { Card::SUIT::HEART, Card::RANK::THREE },
-        { Card::SUIT::HEART, Card::RANK::FOUR },
-        { Card::SUIT::HEART, Card::RANK::FIVE },
-        { Card::SUIT::HEART, Card::RANK::SIX },
-        { Card::SUIT::HEART, Card::RANK::SEVEN },
-        { Card::SUIT::HEART, Card::RANK::EIGHT },
-        { Card::SUIT::HEART, Card::RANK::NINE },
-        { Card::SUIT::HEART, Card::RANK::TEN },
-        { Card::SUIT::HEART, Card::RANK::J },
-        { Card::SUIT::HEART, Card::RANK::Q },
-        { Card::SUIT::HEART, Card::RANK::K },
-
-        { Card::SUIT::DIAMOND, Card::RANK::A },
-        { Card::SUIT::DIAMOND, Card::RANK::TWO },
-        { Card::SUIT::DIAMOND, Card::RANK::THREE },
-        { Card::SUIT::DIAMOND, Card::RANK::FOUR },
-        { Card::SUIT::DIAMOND, Card::RANK::FIVE },
-        { Card::SUIT::DIAMOND, Card::RANK::SIX },
-        { Card::SUIT::DIAMOND, Card::RANK::SEVEN },
-        { Card::SUIT::DIAMOND, Card::RANK::EIGHT },
-        { Card::SUIT::DIAMOND, Card::RANK::NINE },
-        { Card::SUIT::DIAMOND, Card::RANK::TEN },
-        { Card::SUIT::DIAMOND, Card::RANK::J },
-        { Card::SUIT::DIAMOND, Card::RANK::Q },
-        { Card::SUIT::DIAMOND, Card::RANK::K },
-
-        { Card::SUIT::CLUB, Card::RANK::A },
-        { Card::SUIT::CLUB, Card::RANK::TWO },
-        { Card::SUIT::CLUB, Card::RANK::THREE },
-        { Card::SUIT::CLUB, Card::RANK::FOUR },
-        { Card::SUIT::CLUB, Card::RANK::FIVE },
-        { Card::SUIT::CLUB, Card::RANK::SIX },
-        { Card::SUIT::CLUB, Card::RANK::SEVEN },
-        { Card::SUIT::CLUB, Card::RANK::EIGHT },
-        { Card::SUIT::CLUB, Card::RANK::NINE },
-        { Card::SUIT::CLUB, Card::RANK::TEN },
-        { Card::SUIT::CLUB, Card::RANK::J },
-        { Card::SUIT::CLUB, Card::RANK::Q },
-        { Card::SUIT::CLUB, Card::RANK::K },
-
-        { Card::SUIT::SPADE, Card::RANK::A },
-        { Card::SUIT::SPADE, Card::RANK::TWO },
-        { Card::SUIT::SPADE, Card::RANK::THREE },
-        { Card::SUIT::SPADE, Card::RANK::FOUR },
-        { Card::SUIT::SPADE, Card::RANK::FIVE },
-        { Card::SUIT::SPADE, Card::RANK::SIX },
-        { Card::SUIT::SPADE, Card::RANK::SEVEN },
-        { Card::SUIT::SPADE, Card::RANK::EIGHT },
-        { Card::SUIT::SPADE, Card::RANK::NINE },
-        { Card::SUIT::SPADE, Card::RANK::TEN },
-        { Card::SUIT::SPADE, Card::RANK::J },
-        { Card::SUIT::SPADE, Card::RANK::Q },
-        { Card::SUIT::SPADE, Card::RANK::K },
-    };
+    auto standartDeck = Deck::standard();
 
     /////////// SHUFFLE ///////////
     cout << "Testing shuffle...." << endl;
@@ -198,54 +99,104 @@ int main()
                                  Card( Card::SUIT::HEART, Card::RANK::Q ),
                              }) << endl;
 
-    cout << endl << "Bye!!!" << endl;
-    return 0;
-}
-
-
-/////////////////////////// Card class //////////////////////////////
-bool operator < (const Card& lhs, const Card& rhs)
-{
-    return lhs.m_rank < rhs.m_rank;
-}
-
-bool operator > (const Card& lhs, const Card& rhs)
-{
-    return rhs < lhs;
-}
-
-bool operator == (const Card& lhs, const Card& rhs)
-{
-    return lhs.m_suit == rhs.m_suit;
-}
+    /////////// HAND ///////////
+    cout << "Testing 7-card hand masks...." << endl;
 
-bool operator != (const Card& lhs, const Card& rhs)
-{
-    return !(lhs == rhs);
-}
+    const Hand hand = {
+        { Card::SUIT::SPADE, Card::RANK::NINE },
+        { Card::SUIT::SPADE, Card::RANK::TWO },
+        { Card::SUIT::HEART, Card::RANK::FOUR },
+        { Card::SUIT::SPADE, Card::RANK::K },
+        { Card::SUIT::SPADE, Card::RANK::FIVE },
+        { Card::SUIT::CLUB, Card::RANK::THREE },
+        { Card::SUIT::SPADE, Card::RANK::A },
+    };
+    cout << "\t[9s, 2s, 4h, Ks, 5s, 3c, As] is flush? (true) -> " << hand.isFlush() << endl;
+    cout << "\t[9s, 2s, 4h, Ks, 5s, 3c, As] is straight? (true) -> " << hand.isStraight() << endl;
 
-std::ostream& operator << (std::ostream& os, const Card& card)
-{
-    return os << "suit: " << unsigned(card.m_suit) << ", rank: " << unsigned(card.m_rank);
-}
+    /////////// SHOWDOWN ///////////
+    cout << "Testing hand ranking...." << endl;
 
+    const Hand board = {
+        { Card::SUIT::SPADE, Card::RANK::K },
+        { Card::SUIT::HEART, Card::RANK::K },
+        { Card::SUIT::CLUB, Card::RANK::SEVEN },
+        { Card::SUIT::DIAMOND, Card::RANK::TWO },
+        { Card::SUIT::SPADE, Card::RANK::SEVEN },
+    };
+    auto kings = board, sevens = board;
+    kings += { Card::SUIT::CLUB, Card::RANK::K };
+    kings += { Card::SUIT::CLUB, Card::RANK::TWO };
+    sevens += { Card::SUIT::HEART, Card::RANK::SEVEN };
+    sevens += { Card::SUIT::DIAMOND, Card::RANK::SEVEN };
+    auto kingsStrength = HandEvaluator::evaluate(kings), sevensStrength = HandEvaluator::evaluate(sevens);
+    cout << "\t[Kc, 2c] full house? (true) -> "
+         << (HandEvaluator::category(kingsStrength) == HandEvaluator::CATEGORY::FULL_HOUSE) << endl;
+    cout << "\t[7h, 7d] quads? (true) -> "
+         << (HandEvaluator::category(sevensStrength) == HandEvaluator::CATEGORY::QUADS) << endl;
+    cout << "\t[7h, 7d] beats [Kc, 2c]? (true) -> " << (sevensStrength > kingsStrength) << endl;
+
+    /////////// BATCH ///////////
+    cout << "Testing batch evaluation (" << HandEvaluator::kernel() << ")...." << endl;
+
+    HandBatch batch;
+    for(int i = 0; i < 50; ++i) {
+        batch.push(i % 2 ? kings : sevens);
+    }
+    std::vector<uint32_t> strengths(batch.size());
+    HandEvaluator::evaluate(batch, strengths.data());
+    cout << "\tbatch matches single hands? (true) -> "
+         << (strengths[0] == sevensStrength && strengths[49] == kingsStrength) << endl;
 
+    /////////// EQUITY ///////////
+    cout << "Testing equity simulation...." << endl;
 
-/////////////////////////// Deck class //////////////////////////////
-bool Deck::isFlush(CardList cards)
-{
-    return cards.size() && std::equal(cards.begin() + 1, cards.end(), cards.begin());
-}
+    const Hand aces = { { Card::SUIT::HEART, Card::RANK::A }, { Card::SUIT::SPADE, Card::RANK::A } };
+    const Hand kingsHole = { { Card::SUIT::CLUB, Card::RANK::K }, { Card::SUIT::DIAMOND, Card::RANK::K } };
+    auto players = EquitySimulator({ aces, kingsHole }).run(1000000, 1);
+    cout << "\t[Ah, As] vs [Kc, Kd] equity (0.8126) -> " << players[0].equity
+         << " +- " << players[0].stdError << endl;
 
-bool Deck::isStraight(const std::array<Card, 5> &cards)
-{                                                               // FYI - cards = [10, K, A, J, Q]
-    auto maxRank = unsigned(Card::RANK::K);                     // FYI - maxRank = 13
-    auto strbits = std::string(maxRank, '0');                   // FYI - strbits = "0000000000000"
-    for(auto card: cards) {
-        strbits[unsigned(card.rank()) - 1] = '1';               // FYI - strbits = "1000000001111"
-    }
-    strbits += strbits.substr(0, 5);                            // FYI - strbits = "100000000111110000"
-    auto found = strbits.find("11111");                         // FYI - search for "11111"
+    const Hand flop = {
+        { Card::SUIT::HEART, Card::RANK::TEN },
+        { Card::SUIT::CLUB, Card::RANK::TWO },
+        { Card::SUIT::DIAMOND, Card::RANK::NINE },
+    };
+    EquitySimulator flopSpot({ aces, kingsHole }, flop);
+    players = flopSpot.enumerate();
+    cout << "\t[Ah, As] vs [Kc, Kd] on [Th, 2c, 9d] exact equity over " << flopSpot.boards()
+         << " boards (0.9) -> " << players[0].equity << endl;
+
+    /////////// RANGES ///////////
+    cout << "Testing range vs range equity...." << endl;
+
+    RangeEquity rangeEquity;
+    const Range tight("QQ+, AKs"), wide("JJ-99, AQs+, KQo");
+    auto result = rangeEquity.compare(tight, wide, flop);
+    cout << "\t[QQ+, AKs] vs [JJ-99, AQs+, KQo] on [Th, 2c, 9d] (0.6212) -> " << result.equity
+         << " over " << result.matchups << " matchups" << endl;
+    const Hand isomorphicFlop = {
+        { Card::SUIT::DIAMOND, Card::RANK::TEN },
+        { Card::SUIT::SPADE, Card::RANK::TWO },
+        { Card::SUIT::HEART, Card::RANK::NINE },
+    };
+    result = rangeEquity.compare(tight, wide, isomorphicFlop);
+    cout << "\tsame on [Td, 2s, 9h] from cache? (1) -> " << rangeEquity.cached() << " cached result" << endl;
+
+    /////////// ISOMORPHISM ///////////
+    cout << "Testing suit isomorphism...." << endl;
+
+    HandIndexer preflop({ 2 }), holeAndFlop({ 2, 3 });
+    cout << "\tpreflop classes (169) -> " << preflop.size() << endl;
+    cout << "\thole + flop classes (1286792) -> " << holeAndFlop.size() << endl;
+    cout << "\t[Ah, As] and [Kc, Kd] same class? (false) -> "
+         << (preflop.index({ aces }) == preflop.index({ kingsHole })) << endl;
+    cout << "\t[Ah, As] + [Th, 2c, 9d] same as [Ad, Ac] + [Td, 2h, 9s]? (true) -> "
+         << (holeAndFlop.index({ aces, flop }) ==
+             holeAndFlop.index({ { { Card::SUIT::DIAMOND, Card::RANK::A }, { Card::SUIT::CLUB, Card::RANK::A } },
+                                 { { Card::SUIT::DIAMOND, Card::RANK::TEN }, { Card::SUIT::HEART, Card::RANK::TWO },
+                                   { Card::SUIT::SPADE, Card::RANK::NINE } } })) << endl;
 
-    return found != std::string::npos;                          // FYI - return result
+    cout << endl << "Bye!!!" << endl;
+    return 0;
 }
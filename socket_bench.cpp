@@ -0,0 +1,617 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "event_listener.hpp"
+
+// Load generator for the EventListener echo path. Starts an in-process
+// listener on loopback and drives it from a few client threads, each of
+// which multiplexes its share of the connections over its own epoll.
+
+struct BenchConfig
+{
+    int port                   = 3679;
+    unsigned clients           = 1000;
+    unsigned clientThreads     = 2;
+    unsigned serverThreads     = std::max( 1u, std::thread::hardware_concurrency() );
+    unsigned reactors          = 1;
+    std::size_t messageSize    = 64;
+    unsigned depth             = 1;     // messages in flight per connection
+    unsigned churn             = 0;     // reconnect after this many messages, 0 = never
+    bool coroutine             = false; // serve through onConnection instead of onRead
+    EventListener::Framing framing = EventListener::Framing::Raw;
+    EventListener::Backend backend = EventListener::Backend::Epoll;
+    double duration            = 5.0;   // seconds
+    std::string output         = "bench_result.json";
+};
+
+struct BenchTotals
+{
+    std::atomic<uint64_t> connections { 0 };
+    std::atomic<uint64_t> messages { 0 };
+    std::atomic<uint64_t> bytes { 0 };
+    std::atomic<uint64_t> errors { 0 };
+
+    LatencyHistogram latency;   // nanoseconds, send -> echo fully received
+};
+
+class BenchClient
+{
+public:
+    BenchClient( const BenchConfig& config, BenchTotals& totals, unsigned numConnections );
+    ~BenchClient();
+
+    void run( std::chrono::steady_clock::time_point deadline );
+
+    BenchClient( const BenchClient& )            = delete;
+    BenchClient& operator=( const BenchClient& ) = delete;
+
+private:
+    struct Connection
+    {
+        int fileDescriptor     = -1;
+        uint64_t sentMessages  = 0;     // on this connection
+        uint64_t doneMessages  = 0;
+        std::size_t unsentBytes = 0;
+        std::size_t receivedBytes = 0;  // of the message at the head of the pipeline
+        std::vector<std::chrono::steady_clock::time_point> sentAt;
+    };
+
+    bool connect( Connection& connection );
+    void disconnect( Connection& connection );
+    void send( Connection& connection );
+    void receive( Connection& connection );
+
+    const BenchConfig& m_config;
+    BenchTotals& m_totals;
+
+    int m_epollFileDescriptor = -1;
+
+    std::vector<Connection> m_connections;
+    std::string m_payload;
+};
+
+static bool waitForListener( int port, std::chrono::milliseconds timeout );
+static void parseArguments( int argc, char** argv, BenchConfig& config );
+static void writeResult( const BenchConfig& config, BenchTotals& totals, double seconds );
+
+int main( int argc, char** argv )
+{
+    using std::cout;
+    using std::endl;
+
+    BenchConfig config;
+    parseArguments( argc, argv, config );
+
+    {
+        // Each client costs two descriptors in this process
+        rlimit limit;
+
+        if( getrlimit( RLIMIT_NOFILE, &limit ) == 0 )
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit( RLIMIT_NOFILE, &limit );
+        }
+    }
+
+    EventListener eventListener;
+    eventListener.setPort( config.port );
+    eventListener.setBacklog( 4096 );
+    eventListener.setThreadCount( config.serverThreads );
+    eventListener.setReactorCount( config.reactors );
+    eventListener.setFraming( config.framing );
+    eventListener.setBackend( config.backend );
+
+    // Framed echo sends every frame back as it came in, so the clients
+    // see the same bytes either way
+    if( config.coroutine && config.framing != EventListener::Framing::Raw )
+    {
+        eventListener.onConnection( [] ( std::shared_ptr<EventWorker> ew ) -> ConnectionTask
+        {
+            while( 1 )
+            {
+                auto& frames = co_await ew->asyncReadFrames();
+
+                if( frames.empty() )
+                    break;
+
+                for( auto&& frame : frames )
+                {
+                    if( !co_await ew->asyncWriteFrame( frame ) )
+                        co_return;
+                }
+            }
+        } );
+    }
+    else if( config.coroutine )
+    {
+        eventListener.onConnection( [] ( std::shared_ptr<EventWorker> ew ) -> ConnectionTask
+        {
+            while( 1 )
+            {
+                auto data = co_await ew->asyncRead();
+
+                if( data.empty() || !co_await ew->asyncWrite( data ) )
+                    break;
+            }
+        } );
+    }
+    else if( config.framing != EventListener::Framing::Raw )
+    {
+        eventListener.onFrames( [] ( std::weak_ptr<EventWorker> eventWorker,
+                                     const std::vector<std::string_view>& frames )
+        {
+            if( auto ew = eventWorker.lock() )
+            {
+                for( auto&& frame : frames )
+                    ew->writeFrame( frame );
+            }
+        } );
+    }
+    else
+    {
+        eventListener.onRead( [] ( std::weak_ptr<EventWorker> eventWorker )
+        {
+            if( auto ew = eventWorker.lock() )
+                ew->write( ew->read() );
+        } );
+    }
+
+    std::thread server( [&eventListener]
+    {
+        try
+        {
+            eventListener.listen();
+        }
+        catch( const std::exception& e )
+        {
+            std::cerr << "listen failed: " << e.what() << std::endl;
+        }
+    } );
+
+    if( !waitForListener( config.port, std::chrono::seconds( 5 ) ) )
+    {
+        std::cerr << "listener did not come up on port " << config.port << std::endl;
+        eventListener.close();
+        server.join();
+        return 1;
+    }
+
+    cout << "Benchmarking echo on port " << config.port << ": "
+         << config.clients << " clients, "
+         << config.messageSize << " byte messages, depth " << config.depth
+         << ", churn " << config.churn << ", " << config.duration << " s"
+         << ( config.coroutine ? ", coroutine handler" : "" )
+         << ( config.framing == EventListener::Framing::LengthPrefixed ? ", length-prefixed frames" :
+              config.framing == EventListener::Framing::Newline ? ", newline frames" : "" ) << endl;
+
+    BenchTotals totals;
+
+    std::vector< std::unique_ptr<BenchClient> > clients;
+    std::vector<std::thread> clientThreads;
+
+    for( unsigned i = 0; i < config.clientThreads; i++ )
+    {
+        unsigned numConnections = config.clients / config.clientThreads
+                                + ( i < config.clients % config.clientThreads ? 1 : 0 );
+
+        clients.emplace_back( new BenchClient( config, totals, numConnections ) );
+    }
+
+    auto start    = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>( config.duration ) );
+
+    for( auto&& client : clients )
+        clientThreads.emplace_back( &BenchClient::run, client.get(), deadline );
+
+    for( auto&& thread : clientThreads )
+        thread.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    clients.clear();
+
+    eventListener.dumpStats( cout );
+    eventListener.close();
+    server.join();
+
+    writeResult( config, totals, elapsed.count() );
+
+    return totals.errors ? 1 : 0;
+}
+
+
+/////////////////////////// BenchClient class //////////////////////////////
+BenchClient::BenchClient( const BenchConfig& config, BenchTotals& totals, unsigned numConnections )
+    : m_config( config )
+    , m_totals( totals )
+    , m_connections( numConnections )
+{
+    m_epollFileDescriptor = epoll_create1( EPOLL_CLOEXEC );
+
+    if( m_epollFileDescriptor == -1 )
+        throw std::runtime_error( std::string( strerror( errno ) ) );
+
+    // One full pipeline worth of bytes, sent from this buffer over and over.
+    // Each message is one frame when the server parses frames.
+    std::string message( config.messageSize, 'x' );
+
+    if( config.framing == EventListener::Framing::LengthPrefixed )
+    {
+        uint32_t length = htonl( uint32_t( config.messageSize - sizeof( length ) ) );
+        std::copy( reinterpret_cast<const char*>( &length ),
+                   reinterpret_cast<const char*>( &length ) + sizeof( length ),
+                   message.begin() );
+    }
+    else if( config.framing == EventListener::Framing::Newline )
+    {
+        message.back() = '\n';
+    }
+
+    for( unsigned i = 0; i < config.depth; i++ )
+        m_payload += message;
+
+    for( auto&& connection : m_connections )
+        connection.sentAt.resize( config.depth );
+}
+
+BenchClient::~BenchClient()
+{
+    for( auto&& connection : m_connections )
+        disconnect( connection );
+
+    if( m_epollFileDescriptor != -1 )
+        ::close( m_epollFileDescriptor );
+}
+
+void BenchClient::run( std::chrono::steady_clock::time_point deadline )
+{
+    for( auto&& connection : m_connections )
+        connect( connection );
+
+    std::vector<epoll_event> readyEvents( 1024 );
+
+    while( std::chrono::steady_clock::now() < deadline )
+    {
+        int numFileDescriptors = epoll_wait( m_epollFileDescriptor,
+                                             readyEvents.data(),
+                                             static_cast<int>( readyEvents.size() ),
+                                             10 );
+
+        for( int n = 0; n < numFileDescriptors; n++ )
+        {
+            auto& connection = m_connections[readyEvents[n].data.u32];
+
+            if( readyEvents[n].events & ( EPOLLERR | EPOLLHUP ) )
+            {
+                m_totals.errors++;
+                disconnect( connection );
+                connect( connection );
+                continue;
+            }
+
+            if( readyEvents[n].events & EPOLLOUT )
+                send( connection );
+
+            if( readyEvents[n].events & EPOLLIN )
+                receive( connection );
+        }
+    }
+}
+
+// A failed connect is counted as an error and leaves the connection down,
+// running out of descriptors must not take the client thread with it
+bool BenchClient::connect( Connection& connection )
+{
+    int fileDescriptor = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+    if( fileDescriptor == -1 )
+    {
+        m_totals.errors++;
+        return false;
+    }
+
+    sockaddr_in socketAddress;
+
+    std::fill( reinterpret_cast<char*>( &socketAddress ),
+               reinterpret_cast<char*>( &socketAddress ) + sizeof( socketAddress ),
+               0 );
+
+    socketAddress.sin_family      = AF_INET;
+    socketAddress.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    socketAddress.sin_port        = htons( m_config.port );
+
+    // Blocking connect, loopback handshakes complete right away
+    int result = ::connect( fileDescriptor,
+                            reinterpret_cast<const sockaddr*>( &socketAddress ),
+                            sizeof( socketAddress ) );
+
+    if( result == -1 )
+    {
+        ::close( fileDescriptor );
+        m_totals.errors++;
+        return false;
+    }
+
+    {
+        int option = 1;
+        setsockopt( fileDescriptor, IPPROTO_TCP, TCP_NODELAY, &option, sizeof( option ) );
+    }
+
+    int flags = fcntl( fileDescriptor, F_GETFL, 0 );
+    fcntl( fileDescriptor, F_SETFL, flags | O_NONBLOCK );
+
+    connection.fileDescriptor = fileDescriptor;
+    connection.sentMessages   = 0;
+    connection.doneMessages   = 0;
+    connection.unsentBytes    = 0;
+    connection.receivedBytes  = 0;
+
+    epoll_event event;
+    event.events   = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.u64 = 0;
+    event.data.u32 = static_cast<uint32_t>( &connection - m_connections.data() );
+
+    epoll_ctl( m_epollFileDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event );
+
+    m_totals.connections++;
+
+    send( connection );
+
+    return true;
+}
+
+void BenchClient::disconnect( Connection& connection )
+{
+    if( connection.fileDescriptor == -1 )
+        return;
+
+    epoll_ctl( m_epollFileDescriptor, EPOLL_CTL_DEL, connection.fileDescriptor, nullptr );
+    ::close( connection.fileDescriptor );
+
+    connection.fileDescriptor = -1;
+}
+
+void BenchClient::send( Connection& connection )
+{
+    // Top the pipeline up to 'depth' messages in flight
+    auto now = std::chrono::steady_clock::now();
+
+    while( connection.sentMessages - connection.doneMessages < m_config.depth &&
+           ( m_config.churn == 0 || connection.sentMessages < m_config.churn ) )
+    {
+        connection.sentAt[connection.sentMessages % m_config.depth] = now;
+        connection.sentMessages++;
+        connection.unsentBytes += m_config.messageSize;
+    }
+
+    while( connection.unsentBytes > 0 )
+    {
+        auto numBytes = std::min( connection.unsentBytes, m_payload.size() );
+        auto result   = ::send( connection.fileDescriptor, m_payload.data(), numBytes, MSG_NOSIGNAL );
+
+        if( result <= 0 )
+        {
+            if( result == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+                return;
+
+            m_totals.errors++;
+            return;
+        }
+
+        connection.unsentBytes -= result;
+    }
+}
+
+void BenchClient::receive( Connection& connection )
+{
+    static thread_local char buffer[65536];
+
+    while( connection.fileDescriptor != -1 )
+    {
+        auto result = recv( connection.fileDescriptor, buffer, sizeof( buffer ), 0 );
+
+        if( result == 0 || ( result == -1 && errno != EAGAIN && errno != EWOULDBLOCK ) )
+        {
+            m_totals.errors++;
+            disconnect( connection );
+            connect( connection );
+            return;
+        }
+
+        if( result == -1 )
+            break;
+
+        m_totals.bytes += result;
+
+        // Echoes come back in order, account complete messages
+        std::size_t numBytes = result;
+        auto now             = std::chrono::steady_clock::now();
+
+        while( numBytes > 0 )
+        {
+            auto needed = m_config.messageSize - connection.receivedBytes;
+            auto taken  = std::min( needed, numBytes );
+
+            connection.receivedBytes += taken;
+            numBytes                 -= taken;
+
+            if( connection.receivedBytes == m_config.messageSize )
+            {
+                auto sentAt = connection.sentAt[connection.doneMessages % m_config.depth];
+
+                m_totals.latency.record( std::chrono::duration_cast<std::chrono::nanoseconds>( now - sentAt ).count() );
+                m_totals.messages++;
+
+                connection.doneMessages++;
+                connection.receivedBytes = 0;
+            }
+        }
+
+        if( m_config.churn && connection.doneMessages >= m_config.churn )
+        {
+            disconnect( connection );
+            connect( connection );
+            return;
+        }
+    }
+
+    send( connection );
+}
+
+
+/////////////////////////// helpers //////////////////////////////
+static bool waitForListener( int port, std::chrono::milliseconds timeout )
+{
+    // listen() binds on the server thread, retry until it accepts
+    sockaddr_in socketAddress;
+
+    std::fill( reinterpret_cast<char*>( &socketAddress ),
+               reinterpret_cast<char*>( &socketAddress ) + sizeof( socketAddress ),
+               0 );
+
+    socketAddress.sin_family      = AF_INET;
+    socketAddress.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    socketAddress.sin_port        = htons( port );
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while( 1 )
+    {
+        int fileDescriptor = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+        if( fileDescriptor == -1 )
+            return false;
+
+        int result = ::connect( fileDescriptor,
+                                reinterpret_cast<const sockaddr*>( &socketAddress ),
+                                sizeof( socketAddress ) );
+        ::close( fileDescriptor );
+
+        if( result == 0 )
+            return true;
+
+        if( std::chrono::steady_clock::now() >= deadline )
+            return false;
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    }
+}
+
+static void parseArguments( int argc, char** argv, BenchConfig& config )
+{
+    for( int i = 1; i < argc; i++ )
+    {
+        std::string_view option = argv[i];
+
+        if( option == "--help" || i + 1 >= argc )
+        {
+            std::cout << "usage: " << argv[0] << " [--clients N] [--client-threads N] [--server-threads N]"
+                      << " [--reactors N] [--size BYTES] [--depth N] [--churn N] [--duration SECONDS]"
+                      << " [--handler callback|coroutine] [--framing raw|length|newline]"
+                      << " [--backend epoll|io_uring]"
+                      << " [--port PORT] [--output FILE]" << std::endl;
+            std::exit( option == "--help" ? 0 : 1 );
+        }
+
+        std::string value = argv[++i];
+
+        if( option == "--clients" )             config.clients       = std::stoul( value );
+        else if( option == "--client-threads" ) config.clientThreads = std::max( 1ul, std::stoul( value ) );
+        else if( option == "--server-threads" ) config.serverThreads = std::max( 1ul, std::stoul( value ) );
+        else if( option == "--reactors" )       config.reactors      = std::max( 1ul, std::stoul( value ) );
+        else if( option == "--size" )           config.messageSize   = std::max( 1ul, std::stoul( value ) );
+        else if( option == "--depth" )          config.depth         = std::max( 1ul, std::stoul( value ) );
+        else if( option == "--churn" )          config.churn         = std::stoul( value );
+        else if( option == "--duration" )       config.duration      = std::stod( value );
+        else if( option == "--port" )           config.port          = std::stoi( value );
+        else if( option == "--output" )         config.output        = value;
+        else if( option == "--handler" )        config.coroutine     = ( value == "coroutine" );
+        else if( option == "--backend" )
+        {
+            config.backend = value == "io_uring" ? EventListener::Backend::IoUring : EventListener::Backend::Epoll;
+        }
+        else if( option == "--framing" )
+        {
+            config.framing = value == "length"  ? EventListener::Framing::LengthPrefixed :
+                             value == "newline" ? EventListener::Framing::Newline :
+                                                  EventListener::Framing::Raw;
+        }
+        else
+        {
+            std::cerr << "unknown option " << option << std::endl;
+            std::exit( 1 );
+        }
+    }
+
+    // Room for the length header
+    if( config.framing == EventListener::Framing::LengthPrefixed )
+        config.messageSize = std::max( config.messageSize, sizeof( uint32_t ) );
+}
+
+static void writeResult( const BenchConfig& config, BenchTotals& totals, double seconds )
+{
+    auto microseconds = [] ( uint64_t nanoseconds ) { return nanoseconds / 1000.0; };
+    auto& latency     = totals.latency;
+
+    std::cout << "connections/s: " << totals.connections / seconds << std::endl;
+    std::cout << "messages/s:    " << totals.messages / seconds << std::endl;
+    std::cout << "MB/s:          " << totals.bytes / seconds / 1e6 << std::endl;
+    std::cout << "latency (us):  p50 " << microseconds( latency.percentile( 0.5 ) )
+              << ", p99 " << microseconds( latency.percentile( 0.99 ) )
+              << ", p999 " << microseconds( latency.percentile( 0.999 ) )
+              << ", max " << microseconds( latency.max() ) << std::endl;
+    std::cout << "errors:        " << totals.errors << std::endl;
+
+    std::ofstream file( config.output );
+
+    file << "{\n"
+         << "  \"clients\": " << config.clients << ",\n"
+         << "  \"client_threads\": " << config.clientThreads << ",\n"
+         << "  \"server_threads\": " << config.serverThreads << ",\n"
+         << "  \"reactors\": " << config.reactors << ",\n"
+         << "  \"message_size\": " << config.messageSize << ",\n"
+         << "  \"depth\": " << config.depth << ",\n"
+         << "  \"churn\": " << config.churn << ",\n"
+         << "  \"handler\": \"" << ( config.coroutine ? "coroutine" : "callback" ) << "\",\n"
+         << "  \"backend\": \"" << ( config.backend == EventListener::Backend::IoUring ? "io_uring" : "epoll" ) << "\",\n"
+         << "  \"framing\": \"" << ( config.framing == EventListener::Framing::LengthPrefixed ? "length" :
+                                   config.framing == EventListener::Framing::Newline ? "newline" : "raw" ) << "\",\n"
+         << "  \"duration_s\": " << seconds << ",\n"
+         << "  \"connections\": " << totals.connections << ",\n"
+         << "  \"connections_per_s\": " << totals.connections / seconds << ",\n"
+         << "  \"messages\": " << totals.messages << ",\n"
+         << "  \"messages_per_s\": " << totals.messages / seconds << ",\n"
+         << "  \"bytes_per_s\": " << totals.bytes / seconds << ",\n"
+         << "  \"errors\": " << totals.errors << ",\n"
+         << "  \"latency_us\": {\n"
+         << "    \"mean\": " << latency.mean() / 1000.0 << ",\n"
+         << "    \"p50\": " << microseconds( latency.percentile( 0.5 ) ) << ",\n"
+         << "    \"p90\": " << microseconds( latency.percentile( 0.9 ) ) << ",\n"
+         << "    \"p99\": " << microseconds( latency.percentile( 0.99 ) ) << ",\n"
+         << "    \"p999\": " << microseconds( latency.percentile( 0.999 ) ) << ",\n"
+         << "    \"max\": " << microseconds( latency.max() ) << "\n"
+         << "  }\n"
+         << "}\n";
+
+    std::cout << "result written to " << config.output << std::endl;
+}
@@ -1,83 +1,131 @@
 #include <iostream>
-#include <fstream>
 #include <chrono>
 #include <thread>
 #include <random>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <vector>
 #include <algorithm>
-#include <future>
-#include <memory>
-#include <stdexcept>
 #include <string>
-#include <errno.h>
-#include <string.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <unistd.h>
+#include <string_view>
+#include <charconv>
+#include <cstdio>
 #include <signal.h>
 
-class EventWorker;
+#include "event_listener.hpp"
+
+class AsyncLogger;
 
-class EventListener
+// A log line under construction. Formats into a fixed stack buffer and
+// hands the finished record to the logger when it goes out of scope;
+// anything past the capacity is cut off.
+class LogRecord
 {
 public:
-    ~EventListener();
+    static constexpr std::size_t capacity = 4096;
 
-    void setBacklog( int backlog );
-    void setPort( int port );
+    explicit LogRecord( AsyncLogger& logger );
+    ~LogRecord();
 
-    void close();
-    void listen();
-    void close( int fileDescriptor );
+    LogRecord& operator << ( std::string_view text );
+    LogRecord& operator << ( const char* text );
+    LogRecord& operator << ( char c );
+    LogRecord& operator << ( double value );
 
-    template <class F> void onAccept( F&& f ) { m_handleAccept = f; }
-    template <class F> void onRead( F&& f ) { m_handleRead = f; }
+    template <class T, class = std::enable_if_t< std::is_integral<T>::value > >
+    LogRecord& operator << ( T value )
+    {
+        auto result = std::to_chars( m_data + m_size, m_data + capacity, value );
 
-private:
-    int m_backlog =  1;
-    int m_port    = -1;
-    int m_socket  = -1;
+        if( result.ec == std::errc() )
+            m_size = result.ptr - m_data;
 
-    std::function< void ( std::weak_ptr<EventWorker> worker ) > m_handleAccept;
-    std::function< void ( std::weak_ptr<EventWorker> worker ) > m_handleRead;
+        return *this;
+    }
 
-    std::vector< std::shared_ptr<EventWorker> > m_eventWorkers;
+    LogRecord( const LogRecord& )            = delete;
+    LogRecord& operator=( const LogRecord& ) = delete;
 
-    std::vector<int> m_staleFileDescriptors;
-    std::mutex m_staleFileDescriptorsMutex;
+private:
+    AsyncLogger& m_logger;
+    std::size_t m_size = 0;
+    char m_data[capacity];
 };
 
-class EventWorker
+// Logging off the request path. Every producing thread owns a lock-free
+// single-producer ring; a background thread drains all rings and writes
+// them out in large buffered batches. A full ring drops the record (and
+// counts it) instead of waiting for the writer. An idle writer sleeps
+// until a producer wakes it, producers only take the lock while it sleeps.
+class AsyncLogger
 {
 public:
-    EventWorker( int fileDescriptor, EventListener& eventListener );
-    ~EventWorker();
+    enum class Format { Text, Binary };
 
-    int fileDescriptor() const;
+    static constexpr std::size_t ringCapacity = 1 << 18;   // bytes per thread
 
+    ~AsyncLogger();
+
+    bool open( const std::string& path, Format format = Format::Text );
     void close();
-    void write( const std::string& data );
 
-    std::string read();
+    LogRecord record();
+    void write( std::string_view text );
 
-    EventWorker( const EventWorker& )            = delete;
-    EventWorker& operator=( const EventWorker& ) = delete;
+    uint64_t dropped() const;
 
 private:
-    int m_fileDescriptor = -1;
-    EventListener& m_eventListener;
+    // Binary format: this header followed by 'length' bytes of text
+    struct RecordHeader
+    {
+        uint64_t timestamp;     // nanoseconds since the epoch
+        uint32_t thread;
+        uint32_t length;
+    };
+
+    struct Ring
+    {
+        std::atomic<uint64_t> head { 0 };  // advanced by the writer thread
+        std::atomic<uint64_t> tail { 0 };  // advanced by the owning thread
+        std::atomic<uint64_t> dropped { 0 };
+        uint32_t thread = 0;
+        char data[ringCapacity];
+    };
+
+    Ring& localRing();
+    void run();
+    bool drain( Ring& ring, std::string& output );
+    bool pending();
+    void wake();
+
+    std::FILE* m_file = nullptr;
+    Format m_format   = Format::Text;
+    std::atomic<uint64_t> m_id { 0 };       // read by producers in localRing()
+
+    std::vector< std::shared_ptr<Ring> > m_rings;
+    std::mutex m_ringsMutex;
+
+    std::thread m_writer;
+    std::atomic<bool> m_running { false };
+    std::atomic<uint64_t> m_reportedDrops { 0 };
+
+    std::atomic<bool> m_sleeping { false };
+    bool m_wakeRequested = false;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeUp;
 };
 
-static std::fstream outFile;
+static AsyncLogger logger;
 static EventListener eventListener;
 void handleExitSignal( int ) {
-    eventListener.close();
-    outFile.close();
+    eventListener.close(); // async-signal-safe, the reactor does the rest
+}
+
+void handleStatsSignal( int ) {
+    eventListener.requestStatsDump();
 }
 
 int main()
@@ -89,263 +137,338 @@ int main()
     cout << endl;
     cout << "Event Listener started on port: 3678" << endl;
     cout << "See 'log.txt' for details" << endl;
+    cout << "Send SIGUSR1 for statistics" << endl;
+    cout << "Idle connections are dropped after 60 s" << endl;
+    cout << "SIGINT/SIGTERM stop accepting and drain for up to 10 s" << endl;
 
     signal( SIGINT, handleExitSignal );
+    signal( SIGTERM, handleExitSignal );
+    signal( SIGUSR1, handleStatsSignal );
     eventListener.setPort( 3678 );
-    outFile.open("log.txt", std::fstream::out);
-
-    std::mutex fileOutputMutex;
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distr(1000, 5000);
+    eventListener.setIdleTimeout( 60s );
+    eventListener.setDrainTimeout( 10s ); // longer than the slowest echo
+    logger.open( "log.txt" );
 
     eventListener.onRead( [&] ( std::weak_ptr<EventWorker> eventWorker )
     {
         if( auto ew = eventWorker.lock() )
         {
+            // handlers run concurrently on the listener's thread pool
+            thread_local std::mt19937 gen( std::random_device{}() );
+            thread_local std::uniform_int_distribution<> distr(1000, 5000);
+
             auto start = std::chrono::high_resolution_clock::now();
-            std::this_thread::sleep_for(std::chrono::milliseconds{distr(gen)});
-            auto end = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double, std::milli> elapsed = end-start;
 
-            auto data = ew->read();
+            // The echo is delayed on the reactor's timer wheel, no pool
+            // thread waits for it. The view dies with this handler.
+            ew->after( std::chrono::milliseconds{distr(gen)},
+                       [eventWorker, start, data = std::string( ew->read() )]
             {
-                std::lock_guard<std::mutex> lock( fileOutputMutex );
-                outFile << "Worker: " << ew->fileDescriptor() << endl;
-                outFile << "  content:" << endl;
-                outFile << "\t" << data << endl;
-                outFile << "  elapsed: " << elapsed.count() << " ms" << endl << endl;
-            }
-            ew->write( data ); // echo back
+                if( auto ew = eventWorker.lock() )
+                {
+                    auto end = std::chrono::high_resolution_clock::now();
+                    std::chrono::duration<double, std::milli> elapsed = end-start;
+
+                    logger.record() << "Worker: " << ew->fileDescriptor() << '\n'
+                                    << "  content:" << '\n'
+                                    << '\t' << data << '\n'
+                                    << "  elapsed: " << elapsed.count() << " ms" << '\n' << '\n';
+
+                    ew->write( data ); // echo back
+                }
+            } );
         }
     } );
 
     eventListener.listen();
+    logger.close();
 
     return 0;
 }
 
 
-/////////////////////////// EventListener class //////////////////////////////
-EventListener::~EventListener()
+/////////////////////////// LogRecord class //////////////////////////////
+LogRecord::LogRecord( AsyncLogger& logger )
+    : m_logger( logger )
 {
-    this->close();
 }
 
-void EventListener::setBacklog( int backlog )
+LogRecord::~LogRecord()
+{
+    m_logger.write( std::string_view( m_data, m_size ) );
+}
+
+LogRecord& LogRecord::operator << ( std::string_view text )
+{
+    auto numBytes = std::min( text.size(), capacity - m_size );
+
+    std::copy( text.data(), text.data() + numBytes, m_data + m_size );
+    m_size += numBytes;
+
+    return *this;
+}
+
+LogRecord& LogRecord::operator << ( const char* text )
 {
-    m_backlog = backlog;
+    return *this << std::string_view( text );
 }
 
-void EventListener::setPort( int port )
+LogRecord& LogRecord::operator << ( char c )
 {
-    m_port = port;
+    return *this << std::string_view( &c, 1 );
 }
 
-void EventListener::close()
+LogRecord& LogRecord::operator << ( double value )
 {
-    if( m_socket )
-        ::close( m_socket );
+    auto result = std::to_chars( m_data + m_size, m_data + capacity, value );
 
-    for( auto&& eventWorker : m_eventWorkers )
-        eventWorker->close();
+    if( result.ec == std::errc() )
+        m_size = result.ptr - m_data;
 
-    m_eventWorkers.clear();
+    return *this;
 }
 
-void EventListener::listen()
+
+/////////////////////////// AsyncLogger class //////////////////////////////
+AsyncLogger::~AsyncLogger()
 {
-    m_socket = socket( AF_INET, SOCK_STREAM, 0 );
+    this->close();
+}
 
-    if( m_socket == -1 )
-        throw std::runtime_error( std::string( strerror( errno ) ) );
+bool AsyncLogger::open( const std::string& path, Format format )
+{
+    this->close();
 
-    {
-        int option = 1;
+    m_file = std::fopen( path.c_str(), format == Format::Binary ? "wb" : "w" );
 
-        setsockopt( m_socket,
-                    SOL_SOCKET,
-                    SO_REUSEADDR,
-                    reinterpret_cast<const void*>( &option ),
-                    sizeof( option ) );
-    }
+    if( !m_file )
+        return false;
 
-    sockaddr_in socketAddress;
+    // The writer thread is the only user of the stream, give it a big buffer
+    std::setvbuf( m_file, nullptr, _IOFBF, 1 << 20 );
 
-    std::fill( reinterpret_cast<char*>( &socketAddress ),
-               reinterpret_cast<char*>( &socketAddress ) + sizeof( socketAddress ),
-               0 );
+    static std::atomic<uint64_t> nextId { 1 };
 
-    socketAddress.sin_family      = AF_INET;
-    socketAddress.sin_addr.s_addr = htonl( INADDR_ANY );
-    socketAddress.sin_port        = htons( m_port );
+    m_format  = format;
+    m_id      = nextId++;
+    m_running = true;
+    m_writer  = std::thread( &AsyncLogger::run, this );
 
-    {
-        auto result = bind( m_socket,
-                            reinterpret_cast<const sockaddr*>( &socketAddress ),
-                            sizeof( socketAddress ) );
+    return true;
+}
 
-        if( result == -1 )
-            throw std::runtime_error( std::string( strerror( errno ) ) );
+void AsyncLogger::close()
+{
+    if( m_writer.joinable() )
+    {
+        m_running = false;
+        wake();
+        m_writer.join();
     }
 
-    {
-        int result = ::listen( m_socket, m_backlog );
+    if( m_file )
+        std::fclose( m_file );
 
-        if( result == -1 )
-            throw std::runtime_error( std::string( strerror( errno ) ) );
-    }
+    m_file = nullptr;
+    m_id   = 0;
+
+    std::lock_guard<std::mutex> lock( m_ringsMutex );
+    m_rings.clear();
+}
 
-    fd_set masterSocketSet;
-    fd_set clientSocketSet;
+LogRecord AsyncLogger::record()
+{
+    return LogRecord( *this );
+}
+
+void AsyncLogger::write( std::string_view text )
+{
+    if( !m_running )
+        return;
 
-    FD_ZERO( &masterSocketSet );
-    FD_SET( m_socket, &masterSocketSet );
+    Ring& ring = localRing();
 
-    int highestFileDescriptor = m_socket;
+    // Records are 8-byte aligned so a header never straddles the wrap point
+    uint64_t recordSize = ( sizeof( RecordHeader ) + text.size() + 7 ) & ~uint64_t( 7 );
+    uint64_t tail       = ring.tail.load( std::memory_order_relaxed );
+    uint64_t head       = ring.head.load( std::memory_order_acquire );
 
-    while( 1 )
+    if( recordSize > ringCapacity - ( tail - head ) )
     {
-        clientSocketSet = masterSocketSet;
+        ring.dropped.fetch_add( 1, std::memory_order_relaxed );
+        return;
+    }
 
-        int numFileDescriptors = select( highestFileDescriptor + 1,
-                                         &clientSocketSet,
-                                         nullptr,
-                                         nullptr,
-                                         nullptr );
+    RecordHeader header;
+    header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::system_clock::now().time_since_epoch() ).count();
+    header.thread    = ring.thread;
+    header.length    = static_cast<uint32_t>( text.size() );
 
-        if( numFileDescriptors == -1 )
-            break;
+    auto put = [&ring] ( uint64_t position, const char* data, std::size_t numBytes )
+    {
+        auto offset = position % ringCapacity;
+        auto first  = std::min<std::size_t>( numBytes, ringCapacity - offset );
 
+        std::copy( data, data + first, ring.data + offset );
+        std::copy( data + first, data + numBytes, ring.data );
+    };
 
-        int newHighestFileDescriptor = highestFileDescriptor;
+    put( tail, reinterpret_cast<const char*>( &header ), sizeof( header ) );
+    put( tail + sizeof( header ), text.data(), text.size() );
 
-        for( int i = 0; i <= highestFileDescriptor; i++ )
-        {
-            if( !FD_ISSET( i, &clientSocketSet ) )
-                continue;
+    // Sequentially consistent against m_sleeping: either the writer sees
+    // this record before it sleeps, or we see it sleeping
+    ring.tail.store( tail + recordSize, std::memory_order_seq_cst );
 
-            // Handle new client
-            if( i == m_socket )
-            {
-                sockaddr_in clientAddress;
-                auto clientAddressLength = sizeof(clientAddress);
+    if( m_sleeping.load( std::memory_order_seq_cst ) )
+        wake();
+}
 
-                int clientFileDescriptor = accept( m_socket,
-                                                   reinterpret_cast<sockaddr*>( &clientAddress ),
-                                                   reinterpret_cast<socklen_t*>( &clientAddressLength ) );
+uint64_t AsyncLogger::dropped() const
+{
+    return m_reportedDrops;
+}
 
-                if( clientFileDescriptor == -1 )
-                    break;
+AsyncLogger::Ring& AsyncLogger::localRing()
+{
+    struct LocalRing
+    {
+        uint64_t loggerId = 0;
+        std::shared_ptr<Ring> ring;
+    };
 
-                FD_SET( clientFileDescriptor, &masterSocketSet );
-                newHighestFileDescriptor = std::max( highestFileDescriptor, clientFileDescriptor );
+    static thread_local LocalRing local;
 
-                auto eventWorker = std::make_shared<EventWorker>( clientFileDescriptor, *this );
+    if( local.loggerId != m_id )
+    {
+        static std::atomic<uint32_t> nextThread { 0 };
 
-                if( m_handleAccept )
-                    auto result = std::async( std::launch::async, m_handleAccept, eventWorker );
+        local.ring         = std::make_shared<Ring>();
+        local.ring->thread = nextThread++;
+        local.loggerId     = m_id;
 
-                m_eventWorkers.push_back( eventWorker );
-            }
+        std::lock_guard<std::mutex> lock( m_ringsMutex );
+        m_rings.push_back( local.ring );
+    }
 
-            // Known client socket
-            else
-            {
-                char buffer[2] = {0,0};
-                int result = recv( i, buffer, 1, MSG_PEEK );
+    return *local.ring;
+}
 
-                if( result <= 0 )
-                {
-                    this->close( i );
-                }
-                else
-                {
-                    auto itEventWorker = std::find_if( m_eventWorkers.begin(), m_eventWorkers.end(),
-                                                       [&] ( std::shared_ptr<EventWorker> eventWorker )
-                    { return eventWorker->fileDescriptor() == i; });
+void AsyncLogger::run()
+{
+    std::string output;
+    output.reserve( 1 << 20 );
 
-                    if( itEventWorker != m_eventWorkers.end() && m_handleRead )
-                        auto result = std::async( std::launch::async, m_handleRead, *itEventWorker );
-                }
+    while( 1 )
+    {
+        bool running = m_running;
+        bool drained = false;
+        uint64_t dropped = 0;
+
+        {
+            std::lock_guard<std::mutex> lock( m_ringsMutex );
+
+            for( auto&& ring : m_rings )
+            {
+                drained |= drain( *ring, output );
+                dropped += ring->dropped.load( std::memory_order_relaxed );
             }
         }
 
-        highestFileDescriptor = std::max( newHighestFileDescriptor, highestFileDescriptor );
+        if( dropped != m_reportedDrops && m_format == Format::Text )
+            output += "[logger] " + std::to_string( dropped - m_reportedDrops ) + " records dropped\n";
+
+        m_reportedDrops = dropped;
 
+        if( !output.empty() )
         {
-            std::lock_guard<std::mutex> lock( m_staleFileDescriptorsMutex );
+            std::fwrite( output.data(), 1, output.size(), m_file );
+            output.clear();
+        }
+
+        // Once the rings are empty make the batch visible and sleep until
+        // a producer writes; the last pass after close() picks up whatever
+        // is left.
+        if( !drained )
+        {
+            std::fflush( m_file );
 
-            for( auto&& fileDescriptor : m_staleFileDescriptors )
+            if( !running )
+                break;
+
+            m_sleeping = true;
+
+            if( !pending() )
             {
-                FD_CLR( fileDescriptor, &masterSocketSet );
-                ::close( fileDescriptor );
+                std::unique_lock<std::mutex> lock( m_wakeMutex );
+                m_wakeUp.wait( lock, [this] { return m_wakeRequested; } );
             }
 
-            m_staleFileDescriptors.clear();
+            m_sleeping = false;
+
+            std::lock_guard<std::mutex> lock( m_wakeMutex );
+            m_wakeRequested = false;
         }
     }
 }
 
-void EventListener::close( int fileDescriptor )
+bool AsyncLogger::pending()
 {
-    std::lock_guard<std::mutex> lock( m_staleFileDescriptorsMutex );
+    std::lock_guard<std::mutex> lock( m_ringsMutex );
 
-    m_eventWorkers.erase( std::remove_if( m_eventWorkers.begin(), m_eventWorkers.end(),
-                                          [&] ( std::shared_ptr<EventWorker> eventWorker )
-                          {
-                              return eventWorker->fileDescriptor() == fileDescriptor;
-                          } ),
-            m_eventWorkers.end() );
+    for( auto&& ring : m_rings )
+    {
+        if( ring->head.load( std::memory_order_relaxed ) != ring->tail.load( std::memory_order_seq_cst ) )
+            return true;
+    }
 
-    m_staleFileDescriptors.push_back( fileDescriptor );
+    return false;
 }
 
-
-/////////////////////////// EventWorker class //////////////////////////////
-EventWorker::EventWorker( int fileDescriptor, EventListener& eventListener )
-    : m_fileDescriptor( fileDescriptor )
-    , m_eventListener( eventListener )
+void AsyncLogger::wake()
 {
-}
+    {
+        std::lock_guard<std::mutex> lock( m_wakeMutex );
+        m_wakeRequested = true;
+    }
 
-EventWorker::~EventWorker()
-{
+    m_wakeUp.notify_one();
 }
 
-int EventWorker::fileDescriptor() const
+bool AsyncLogger::drain( Ring& ring, std::string& output )
 {
-    return m_fileDescriptor;
-}
+    uint64_t head = ring.head.load( std::memory_order_relaxed );
+    uint64_t tail = ring.tail.load( std::memory_order_acquire );
 
-void EventWorker::close()
-{
-    m_eventListener.close( m_fileDescriptor );
-}
+    if( head == tail )
+        return false;
 
-void EventWorker::write( const std::string& data )
-{
-    auto result = send( m_fileDescriptor,
-                        reinterpret_cast<const void*>( data.c_str() ),
-                        data.size(),
-                        0 );
+    auto get = [&ring] ( uint64_t position, char* data, std::size_t numBytes )
+    {
+        auto offset = position % ringCapacity;
+        auto first  = std::min<std::size_t>( numBytes, ringCapacity - offset );
 
-    if( result == -1 )
-        throw std::runtime_error( std::string( strerror( errno ) ) );
-}
+        std::copy( ring.data + offset, ring.data + offset + first, data );
+        std::copy( ring.data, ring.data + numBytes - first, data + first );
+    };
 
-std::string EventWorker::read()
-{
-    std::string message;
+    while( head != tail )
+    {
+        RecordHeader header;
+        get( head, reinterpret_cast<char*>( &header ), sizeof( header ) );
 
-    char buffer[256] = { 0 };
-    ssize_t numBytes = 0;
+        if( m_format == Format::Binary )
+            output.append( reinterpret_cast<const char*>( &header ), sizeof( header ) );
 
-    while( ( numBytes = recv( m_fileDescriptor, buffer, sizeof(buffer), MSG_DONTWAIT ) ) > 0 )
-    {
-        buffer[numBytes]  = 0;
-        message          += buffer;
+        auto size = output.size();
+        output.resize( size + header.length );
+        get( head + sizeof( header ), &output[size], header.length );
+
+        head += ( sizeof( RecordHeader ) + header.length + 7 ) & ~uint64_t( 7 );
     }
 
-    return message;
+    ring.head.store( head, std::memory_order_release );
+
+    return true;
 }